@@ -0,0 +1,90 @@
+// Cost of builtin_lookup() next to the linear scan it replaced. The perfect
+// hash is built over the real builtins; the scan runs over their names padded
+// out with made-up ones, standing in for a builtin set that has grown. The
+// words looked up are mostly external commands, as in a typical script.
+//
+// Usage: bench_builtin_lookup [lookups]
+
+#include <println/println.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../src/builtin.h"
+
+static const str BUILTIN_NAMES[] = {
+#define X(name, ...) str_lit_c(name),
+#include "../src/builtin.inc"
+#undef X
+};
+
+#define BUILTIN_NAME_COUNT (sizeof(BUILTIN_NAMES) / sizeof(BUILTIN_NAMES[0]))
+#define MAX_NAMES 256
+
+static const str WORDS[] = {
+    str_lit_c("ls"),   str_lit_c("grep"), str_lit_c("cd"),     str_lit_c("git"),
+    str_lit_c("sed"),  str_lit_c("exit"), str_lit_c("make"),   str_lit_c("cat"),
+    str_lit_c("exec"), str_lit_c("awk"),  str_lit_c("mkdir"),  str_lit_c("hash"),
+    str_lit_c("cp"),   str_lit_c("rm"),   str_lit_c("printf"), str_lit_c("xargs"),
+};
+
+#define WORD_COUNT (sizeof(WORDS) / sizeof(WORDS[0]))
+
+static str names[MAX_NAMES];
+// keeps the compiler from dropping the lookups
+static volatile uintptr_t sink;
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static bool scan(str word, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (str_eq(names[i], word)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    long lookups = argc > 1 ? atol(argv[1]) : 10000000;
+    if (lookups <= 0) {
+        fprintfln(stderr, "usage: bench_builtin_lookup [lookups]");
+        return 2;
+    }
+
+    static char padding[MAX_NAMES][16];
+    for (size_t i = 0; i < MAX_NAMES; i++) {
+        if (i < BUILTIN_NAME_COUNT) {
+            names[i] = BUILTIN_NAMES[i];
+        } else {
+            int len = snprintf(padding[i], sizeof(padding[i]), "builtin%zu", i);
+            names[i] = str_ref_chars(padding[i], (size_t)len);
+        }
+    }
+
+    double start = now_seconds();
+    for (long n = 0; n < lookups; n++) {
+        sink += (uintptr_t)builtin_lookup(WORDS[n % WORD_COUNT]);
+    }
+    double elapsed = now_seconds() - start;
+    printfln(
+        "builtin_lookup over %zu builtins: %.2f ns", BUILTIN_NAME_COUNT,
+        elapsed / (double)lookups * 1e9
+    );
+
+    printfln("%8s  %12s", "names", "scan ns");
+    for (size_t count = BUILTIN_NAME_COUNT; count <= MAX_NAMES; count *= 2) {
+        start = now_seconds();
+        for (long n = 0; n < lookups; n++) {
+            sink += scan(WORDS[n % WORD_COUNT], count);
+        }
+        elapsed = now_seconds() - start;
+        printfln("%8zu  %12.2f", count, elapsed / (double)lookups * 1e9);
+    }
+    return 0;
+}
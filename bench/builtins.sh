@@ -0,0 +1,67 @@
+#!/bin/sh
+# Runs a script of 10000 calls to echo, printf, test, [, true, false and pwd
+# twice: once as the shell's builtins and once through the external
+# utilities, by path, so that every line is a fork and exec.
+#
+# Usage: builtins.sh path/to/shlol [lines]
+set -eu
+shlol=$1
+lines=${2:-10000}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# the utility's path in $PATH; `command -v` would name the builtin
+external() {
+    old_ifs=$IFS
+    IFS=:
+    for path_dir in $PATH; do
+        if [ -f "$path_dir/$1" ] && [ -x "$path_dir/$1" ]; then
+            IFS=$old_ifs
+            echo "$path_dir/$1"
+            return
+        fi
+    done
+    echo "builtins.sh: no external $1" >&2
+    exit 1
+}
+
+# found now, so that the shell's PATH search doesn't add to their cost
+echo=$(external echo)
+printf=$(external printf)
+test=$(external test)
+true=$(external true)
+false=$(external false)
+pwd=$(external pwd)
+
+i=0
+while [ "$i" -lt "$lines" ]; do
+    case $((i % 7)) in
+    0) echo "echo line $i" >>"$dir/builtin.sh"; echo "$echo line $i" >>"$dir/external.sh" ;;
+    1) echo "printf %s%s x $i" >>"$dir/builtin.sh"; echo "$printf %s%s x $i" >>"$dir/external.sh" ;;
+    2) echo "test $i -gt 5" >>"$dir/builtin.sh"; echo "$test $i -gt 5" >>"$dir/external.sh" ;;
+    3) echo "[ -n x$i ]" >>"$dir/builtin.sh"; echo "$test -n x$i" >>"$dir/external.sh" ;;
+    4) echo "true" >>"$dir/builtin.sh"; echo "$true" >>"$dir/external.sh" ;;
+    5) echo "false" >>"$dir/builtin.sh"; echo "$false" >>"$dir/external.sh" ;;
+    6) echo "pwd" >>"$dir/builtin.sh"; echo "$pwd" >>"$dir/external.sh" ;;
+    esac
+    i=$((i + 1))
+done
+
+now_ms() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+run() {
+    start=$(now_ms)
+    "$shlol" <"$dir/$1.sh" >/dev/null
+    echo $(($(now_ms) - start))
+}
+
+builtin_ms=$(run builtin)
+external_ms=$(run external)
+echo "$lines lines"
+echo "builtins:  ${builtin_ms} ms"
+echo "external:  ${external_ms} ms"
+if [ "$builtin_ms" -gt 0 ]; then
+    echo "speedup:   $((external_ms / builtin_ms))x"
+fi
@@ -0,0 +1,85 @@
+// Lexer throughput in MB/s over a generated script of typical command lines:
+// short and long words, paths, options and the operators between them.
+//
+// Usage: bench_lexer [MiB of source] [passes]
+
+#include <arena/arena.h>
+#include <buf/buf.h>
+#include <println/println.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/lexer.h"
+
+static const char* const LINES[] = {
+    "cd /usr/local/src/project && make -j8 all install; ",
+    "grep -rn --include=*.c needle src lib || echo not found; ",
+    "( cp build/output/libexample.so.1.2.3 /opt/example/lib ) ; ",
+    "printf %s-%s a_fairly_long_argument_word another_one_here_too; ",
+    "ls -la; true && false || exit; ",
+};
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Lexes all of source and returns the number of tokens.
+static size_t lex_all(str source, Arena* arena) {
+    Lexer lexer = lexer_new(source, arena);
+    size_t tokens = 0;
+    for (Token token = lex_next(&lexer); token.type != TOKEN_TYPE_EOF; token = lex_next(&lexer)) {
+        if (token.type == TOKEN_TYPE_BAD) {
+            fprintfln(stderr, "bench_lexer: bad token at %u", token.start);
+            exit(1);
+        }
+        tokens++;
+    }
+    return tokens;
+}
+
+int main(int argc, char** argv) {
+    long mib = argc > 1 ? atol(argv[1]) : 16;
+    long passes = argc > 2 ? atol(argv[2]) : 10;
+    if (mib <= 0 || mib > 1024 || passes <= 0) {
+        fprintfln(stderr, "usage: bench_lexer [MiB of source] [passes]");
+        return 2;
+    }
+
+    size_t size = (size_t)mib << 20;
+    char* source = malloc(size);
+    if (source == NULL) {
+        fprintfln(stderr, "bench_lexer: cannot allocate %ld MiB", mib);
+        return 1;
+    }
+    size_t len = 0;
+    for (size_t i = 0;; i++) {
+        const char* line = LINES[i % (sizeof(LINES) / sizeof(LINES[0]))];
+        size_t line_len = strlen(line);
+        if (len + line_len > size) {
+            break;
+        }
+        memcpy(source + len, line, line_len);
+        len += line_len;
+    }
+
+    Arena arena = ARENA_NEW;
+    size_t tokens = 0;
+    double start = now_seconds();
+    for (long pass = 0; pass < passes; pass++) {
+        tokens = lex_all(str_ref_chars(source, len), &arena);
+        arena_reset(&arena);
+    }
+    double elapsed = now_seconds() - start;
+
+    printfln(
+        "%zu bytes, %zu tokens: %.1f MB/s", len, tokens,
+        (double)len * (double)passes / elapsed / 1e6
+    );
+    arena_free(&arena);
+    free(source);
+    return 0;
+}
@@ -0,0 +1,67 @@
+// Spawn latency of each backend as the shell's resident set grows. fork has
+// to copy the page tables of the whole shell, so its cost rises with RSS;
+// posix_spawn's vfork-style clone should stay flat.
+//
+// Usage: bench_spawn [spawns per size]
+
+#include <println/println.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "../src/spawn.h"
+
+static const size_t RSS_MIB[] = {0, 64, 256, 512};
+
+static const char* const BACKEND_NAMES[] = {
+#define X(x, name) name,
+#include "../src/spawn_backend.inc"
+#undef X
+};
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    int spawns = argc > 1 ? atoi(argv[1]) : 200;
+    if (spawns <= 0) {
+        fprintfln(stderr, "usage: bench_spawn [spawns per size]");
+        return 2;
+    }
+    str words[] = {str_lit("/bin/true")};
+    WordList command = BUF_ARRAY(words);
+    SpawnDupList dups = BUF_NEW;
+
+    printfln("%8s  %-12s  %10s", "RSS MiB", "backend", "us/spawn");
+    for (size_t i = 0; i < sizeof(RSS_MIB) / sizeof(RSS_MIB[0]); i++) {
+        // touched, so that the pages are really mapped
+        size_t size = RSS_MIB[i] << 20;
+        char* ballast = malloc(size);
+        if (size != 0 && ballast == NULL) {
+            fprintfln(stderr, "bench_spawn: cannot allocate %zu MiB", RSS_MIB[i]);
+            return 1;
+        }
+        memset(ballast, 1, size);
+
+        for (size_t b = 0; b < sizeof(BACKEND_NAMES) / sizeof(BACKEND_NAMES[0]); b++) {
+            spawn_backend = (SpawnBackend)b;
+            double start = now_seconds();
+            for (int n = 0; n < spawns; n++) {
+                pid_t pid = spawn_process(command, dups);
+                if (pid == -1) {
+                    return 1;
+                }
+                waitpid(pid, NULL, 0);
+            }
+            double elapsed = now_seconds() - start;
+            printfln("%8zu  %-12s  %10.1f", RSS_MIB[i], BACKEND_NAMES[b], elapsed / spawns * 1e6);
+        }
+        free(ballast);
+    }
+    return 0;
+}
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Startup latency of `-c true`: shlol next to dash and, if they are installed,
+# bash and busybox sh. Each shell is started the given number of times in a
+# row.
+#
+# Usage: startup.sh path/to/shlol [runs]
+set -eu
+shlol=$1
+runs=${2:-1000}
+
+now_us() {
+    echo $(($(date +%s%N) / 1000))
+}
+
+measure() {
+    name=$1
+    shift
+    start=$(now_us)
+    i=0
+    while [ "$i" -lt "$runs" ]; do
+        "$@" -c true
+        i=$((i + 1))
+    done
+    elapsed=$(($(now_us) - start))
+    printf '%-10s %8d us/run\n' "$name" $((elapsed / runs))
+}
+
+measure shlol "$shlol"
+if ! command -v dash >/dev/null; then
+    echo "startup.sh: dash is not installed, so there is nothing to compare with" >&2
+fi
+for shell in dash bash; do
+    if command -v "$shell" >/dev/null; then
+        measure "$shell" "$shell"
+    fi
+done
+if command -v busybox >/dev/null; then
+    measure busybox busybox sh
+fi
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <buf/buf.h>
+#include <stdalign.h>
+#include <stddef.h>
+
+typedef struct ArenaBlock ArenaBlock;
+
+// A bump allocator. Allocations are never freed individually; arena_reset()
+// releases all of them at once but keeps the blocks around, so an arena that
+// is reset between uses stops calling malloc once it has warmed up.
+typedef struct {
+    ArenaBlock* first;
+    ArenaBlock* current;
+} Arena;
+
+#define ARENA_NEW \
+    { .first = NULL, .current = NULL }
+
+void* arena_alloc(Arena* arena, size_t size, size_t align);
+// Resizes the most recent allocation in place when possible, otherwise copies
+// it to a new allocation.
+void* arena_realloc(Arena* arena, void* ptr, size_t old_size, size_t new_size, size_t align);
+void arena_reset(Arena* arena);
+void arena_free(Arena* arena);
+
+#define ARENA_NEW_OBJ(arena, T) ((T*)arena_alloc((arena), sizeof(T), alignof(T)))
+#define ARENA_NEW_ARRAY(arena, T, n) ((T*)arena_alloc((arena), sizeof(T) * (n), alignof(T)))
+
+// BUF_PUSH for buffers whose storage lives in an arena. Such buffers are marked
+// as references, so BUF_FREE leaves them alone.
+#define ARENA_BUF_PUSH(arena, buf, val) \
+    do { \
+        if ((buf)->len == (buf)->cap) { \
+            uint64_t new_cap_ = (buf)->cap ? (buf)->cap * 2 : 4; \
+            (buf)->ptr = arena_realloc( \
+                (arena), \
+                (buf)->ptr, \
+                (buf)->cap * sizeof(*(buf)->ptr), \
+                new_cap_ * sizeof(*(buf)->ptr), \
+                alignof(max_align_t) \
+            ); \
+            (buf)->cap = new_cap_; \
+            (buf)->ref = true; \
+        } \
+        (buf)->ptr[(buf)->len++] = (val); \
+    } while (false)
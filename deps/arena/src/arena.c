@@ -0,0 +1,88 @@
+#include "arena/arena.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct ArenaBlock {
+    ArenaBlock* next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) unsigned char data[];
+};
+
+static ArenaBlock* block_new(size_t min_size) {
+    size_t size = min_size > ARENA_BLOCK_SIZE ? min_size : ARENA_BLOCK_SIZE;
+    ArenaBlock* block = malloc(sizeof(ArenaBlock) + size);
+    BUF_ASSERT(block != NULL);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+static size_t align_up(size_t n, size_t align) {
+    return (n + align - 1) & ~(align - 1);
+}
+
+void* arena_alloc(Arena* arena, size_t size, size_t align) {
+    if (arena->current == NULL) {
+        if (arena->first == NULL) {
+            arena->first = block_new(size);
+        }
+        arena->current = arena->first;
+    }
+
+    while (true) {
+        ArenaBlock* block = arena->current;
+        size_t start = align_up(block->used, align);
+        if (start + size <= block->size) {
+            block->used = start + size;
+            return block->data + start;
+        }
+        // blocks past the current one are left over from before a reset
+        if (block->next == NULL || block->next->size < size) {
+            ArenaBlock* fresh = block_new(size + align);
+            fresh->next = block->next;
+            block->next = fresh;
+        }
+        arena->current = block->next;
+        arena->current->used = 0;
+    }
+}
+
+void* arena_realloc(Arena* arena, void* ptr, size_t old_size, size_t new_size, size_t align) {
+    ArenaBlock* block = arena->current;
+    if (ptr != NULL && block != NULL && (unsigned char*)ptr + old_size == block->data + block->used &&
+        (size_t)((unsigned char*)ptr - block->data) + new_size <= block->size) {
+        block->used = (size_t)((unsigned char*)ptr - block->data) + new_size;
+        return ptr;
+    }
+
+    void* fresh = arena_alloc(arena, new_size, align);
+    if (ptr != NULL) {
+        memcpy(fresh, ptr, old_size < new_size ? old_size : new_size);
+    }
+    return fresh;
+}
+
+void arena_reset(Arena* arena) {
+    if (arena->first != NULL) {
+        arena->first->used = 0;
+    }
+    arena->current = arena->first;
+}
+
+void arena_free(Arena* arena) {
+    ArenaBlock* block = arena->first;
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+}
@@ -1,7 +1,9 @@
 #ifndef AST_H_
 #define AST_H_
 
+#include <arena/arena.h>
 #include <buf/buf.h>
+#include <stdint.h>
 #include <str/str.h>
 
 typedef BUF(str) WordList;
@@ -12,54 +14,83 @@ typedef enum {
 #undef X
 } CommandType;
 
+// A run of consecutive entries in one of the SyntaxTree tables.
 typedef struct {
-    CommandType type;
-} Command;
+    uint32_t start;
+    uint32_t len;
+} AstSpan;
+
+typedef enum {
+    // fd < path
+    REDIRECT_INPUT,
+    // fd > path
+    REDIRECT_OUTPUT,
+    // fd >> path
+    REDIRECT_APPEND,
+    // fd <& n, fd >& n
+    REDIRECT_DUP,
+    // fd << delimiter, whose body is the word
+    REDIRECT_HEREDOC,
+    // fd <<< word, which is read back with a newline
+    REDIRECT_HERESTRING,
+} RedirectType;
 
 typedef struct {
-    Command base;
-    WordList args;
-    bool negated;
-} SimpleCommand;
+    RedirectType type;
+    // the descriptor being redirected
+    int fd;
+    // DUP: the descriptor copied into fd; otherwise the path or text in
+    // SyntaxTree.words
+    uint32_t target;
+} AstRedirection;
 
-struct Statements;
+typedef BUF(AstRedirection) AstRedirectionBuf;
 
 typedef struct {
-    Command base;
-    struct Statements* statements;
-} SubshellCommand;
-
-typedef BUF(Command*) CommandBuf;
+    CommandType type;
+    bool negated;
+    // SIMPLE: some of its words or redirection paths contain substitutions
+    bool expands;
+    // SIMPLE: the command's words in SyntaxTree.words
+    // SUBSHELL, BACKGROUND: the lists of its body in SyntaxTree.lists
+    // PIPELINE: its stages in SyntaxTree.commands
+    AstSpan span;
+    // SIMPLE: its redirections in SyntaxTree.redirections, applied in order
+    AstSpan redirections;
+} AstCommand;
+
+typedef BUF(AstCommand) AstCommandBuf;
 
 typedef enum {
     OP_AND,
     OP_OR,
+    // follows the last command of a list
+    OP_END,
 } Op;
 
 typedef BUF(Op) OpBuf;
 
+typedef BUF(AstSpan) AstSpanBuf;
+
+// The tree is stored as flat tables that refer to each other by index:
+//  - a list is a span of `commands`, and `ops` runs parallel to `commands`,
+//    holding the operator that follows each one;
+//  - a statement sequence (the root or a subshell body) is a span of `lists`;
+//  - a simple command's arguments are a span of `words`, followed by the
+//    paths and heredoc bodies its redirections refer to;
+//  - a pipeline's stages are a span of `commands`, each followed by OP_END.
+// Nested bodies are complete before their parent, so every span is contiguous.
+// The tables are allocated from the arena the tree was parsed into, and the
+// words point into the parsed source.
 typedef struct {
-    CommandBuf commands;
+    WordList words;
+    AstCommandBuf commands;
     OpBuf ops;
-} CommandList;
-
-typedef BUF(CommandList) CommandListBuf;
-
-typedef struct Statements {
-    CommandListBuf lists;
-} Statements;
-
-typedef struct {
-    Statements* root;
+    AstSpanBuf lists;
+    AstRedirectionBuf redirections;
+    AstSpan root;
 } SyntaxTree;
 
-Command* simple_command_new(WordList args, bool negated);
-Command* subshell_command_new(Statements* statements);
-CommandList command_list_new(void);
-Statements* statements_new(void);
-void command_free(Command* command);
-void command_list_free(CommandList list);
-void statements_free(Statements* statements);
-void syntax_tree_free(SyntaxTree tree);
+SyntaxTree syntax_tree_new(void);
 
 #endif  // AST_H_
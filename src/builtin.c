@@ -0,0 +1,279 @@
+#include "builtin.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <println/println.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <str/strtox.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "coreutils.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "parse_cache.h"
+#include "path_cache.h"
+#include "spawn.h"
+#include "variables.h"
+
+typedef struct {
+    str name;
+    BuiltinCallback* callback;
+    bool stateless;
+} BuiltinWord;
+
+static int cd_command(WordList argv) {
+    bool result = false;
+    if (argv.len == 1) {
+        str home = variable_get(str_lit("HOME"));
+        if (home.ptr == NULL) {
+            printfln("cd: HOME not set");
+            return true;
+        }
+        chdir(home.ptr);
+    } else if (argv.len == 2) {
+        str path = str_dup(argv.ptr[1]);
+        chdir(path.ptr);
+        str_free(path);
+    } else {
+        printfln("cd: too many arguments");
+        result = true;
+    }
+    return result;
+}
+
+static int exit_command(WordList argv) {
+    if (argv.len == 1) {
+        exit(0);
+    }
+    if (argv.len == 2) {
+        Str2I64Result status = str2i64(argv.ptr[1], 10);
+        if (status.err || status.endptr != str_end(argv.ptr[1])) {
+            printfln("exit: invalid argument");
+            return true;
+        }
+        status.value = status.value % 256;
+        exit((int)status.value);
+    }
+
+    printfln("exit: too many arguments");
+    return true;
+}
+
+static int exec_command(WordList argv) {
+    if (argv.len == 1) {
+        return 0;
+    }
+    WordList actual_argv = BUF_SHIFTED(argv, 1);
+    exec_process(actual_argv);
+}
+
+static int hash_command(WordList argv) {
+    if (argv.len == 1) {
+        path_cache_print();
+        return 0;
+    }
+    if (argv.len == 2 && str_eq(argv.ptr[1], str_lit("-r"))) {
+        path_cache_clear();
+        return 0;
+    }
+
+    bool result = false;
+    for (uint64_t i = 1; i < argv.len; i++) {
+        if (!path_cache_lookup(argv.ptr[i]).found) {
+            printfln("hash: " str_fmt ": not found", str_arg(argv.ptr[i]));
+            result = true;
+        }
+    }
+    return result;
+}
+
+static int parsecache_command(WordList argv) {
+    if (argv.len == 2 && str_eq(argv.ptr[1], str_lit("-r"))) {
+        parse_cache_clear();
+        return 0;
+    }
+    if (argv.len != 1) {
+        printfln("parsecache: usage: parsecache [-r]");
+        return true;
+    }
+
+    ParseCacheStats stats = parse_cache_stats();
+    printfln("hits\tmisses\tentries");
+    printfln("%" PRIu64 "\t%" PRIu64 "\t%" PRIu64, stats.hits, stats.misses, stats.entries);
+    return 0;
+}
+
+static int jobs_command(WordList argv) {
+    if (argv.len != 1) {
+        fprintfln(stderr, "jobs: usage: jobs");
+        return 2;
+    }
+    jobs_print(false);
+    return 0;
+}
+
+// wait [-n] [pid | %job]...
+static int wait_command(WordList argv) {
+    if (argv.len == 1) {
+        jobs_wait_all();
+        return 0;
+    }
+    if (argv.len == 2 && str_eq(argv.ptr[1], str_lit("-n"))) {
+        int status;
+        return jobs_wait_any(&status) ? status : 127;
+    }
+
+    int status = 0;
+    for (uint64_t i = 1; i < argv.len; i++) {
+        str arg = argv.ptr[i];
+        bool is_id = str_has_prefix(arg, str_lit("%"));
+        str digits = is_id ? str_after(arg, 1) : arg;
+        Str2U64Result number = str2u64(digits, 10);
+        if (str_is_empty(digits) || number.err || number.endptr != str_end(digits) ||
+            number.value > INT32_MAX) {
+            fprintfln(stderr, "wait: '" str_fmt "': not a pid or job", str_arg(arg));
+            return 2;
+        }
+        bool found = is_id ? jobs_wait_id((uint32_t)number.value, &status)
+                           : jobs_wait_pid((pid_t)number.value, &status);
+        if (!found) {
+            // POSIX: unknown processes are assumed to have exited with 127
+            status = 127;
+        }
+    }
+    return status;
+}
+
+// export [name[=value]]...
+static int export_command(WordList argv) {
+    if (argv.len == 1) {
+        variables_print_exported();
+        return 0;
+    }
+    bool result = false;
+    for (uint64_t i = 1; i < argv.len; i++) {
+        str arg = argv.ptr[i];
+        str_find_result equals = str_find_char(arg, '=');
+        str name = equals.found ? str_upto(arg, equals.pos) : arg;
+        if (!variable_name_valid(name)) {
+            fprintfln(stderr, "export: '" str_fmt "': not a valid identifier", str_arg(arg));
+            result = true;
+            continue;
+        }
+        if (equals.found) {
+            variable_set(name, str_after(arg, equals.pos + 1));
+        }
+        variable_export(name);
+    }
+    return result;
+}
+
+// unset name...
+static int unset_command(WordList argv) {
+    bool result = false;
+    for (uint64_t i = 1; i < argv.len; i++) {
+        if (!variable_name_valid(argv.ptr[i])) {
+            fprintfln(stderr, "unset: '" str_fmt "': not a valid identifier", str_arg(argv.ptr[i]));
+            result = true;
+            continue;
+        }
+        variable_unset(argv.ptr[i]);
+    }
+    return result;
+}
+
+// builtin.inc marks the builtins that change the shell itself, or read state
+// that a subshell would not share, as STATEFUL.
+#define STATEFUL false
+#define STATELESS true
+
+static const BuiltinWord BUILTIN_WORDS[] = {
+#define X(name, callback, state) {str_lit_c(name), callback, state},
+#include "builtin.inc"
+#undef X
+};
+
+#undef STATELESS
+#undef STATEFUL
+
+#define BUILTIN_COUNT (sizeof(BUILTIN_WORDS) / sizeof(BUILTIN_WORDS[0]))
+#define BUILTIN_TABLE_SIZE 256
+
+static_assert(BUILTIN_COUNT * 4 <= BUILTIN_TABLE_SIZE, "builtin table is too crowded");
+
+// Perfect hash over BUILTIN_WORDS: every builtin owns a distinct slot, so a
+// lookup costs one hash, one length check and at most one memcmp. The seed is
+// searched for once, the first time a word is looked up.
+static struct {
+    bool ready;
+    uint32_t seed;
+    size_t max_len;
+    // index into BUILTIN_WORDS plus one; zero marks an empty slot
+    uint8_t slots[BUILTIN_TABLE_SIZE];
+} builtin_table;
+
+static uint32_t hash_word(str word, uint32_t seed) {
+    uint32_t hash = seed ^ (uint32_t)str_len(word);
+    for (size_t i = 0; i < str_len(word); i++) {
+        hash = (hash ^ (unsigned char)word.ptr[i]) * 16777619U;
+    }
+    return (hash ^ (hash >> 16)) % BUILTIN_TABLE_SIZE;
+}
+
+static bool try_seed(uint32_t seed) {
+    memset(builtin_table.slots, 0, sizeof(builtin_table.slots));
+    for (size_t i = 0; i < BUILTIN_COUNT; i++) {
+        uint32_t slot = hash_word(BUILTIN_WORDS[i].name, seed);
+        if (builtin_table.slots[slot] != 0) {
+            return false;
+        }
+        builtin_table.slots[slot] = (uint8_t)(i + 1);
+    }
+    return true;
+}
+
+static void build_table(void) {
+    for (size_t i = 0; i < BUILTIN_COUNT; i++) {
+        if (str_len(BUILTIN_WORDS[i].name) > builtin_table.max_len) {
+            builtin_table.max_len = str_len(BUILTIN_WORDS[i].name);
+        }
+    }
+    uint32_t seed = 2166136261U;
+    while (!try_seed(seed)) {
+        seed++;
+    }
+    builtin_table.seed = seed;
+    builtin_table.ready = true;
+}
+
+static const BuiltinWord* find_builtin(str word) {
+    if (!builtin_table.ready) {
+        build_table();
+    }
+    if (str_len(word) > builtin_table.max_len) {
+        return NULL;
+    }
+
+    uint8_t slot = builtin_table.slots[hash_word(word, builtin_table.seed)];
+    if (slot == 0) {
+        return NULL;
+    }
+    const BuiltinWord* builtin = &BUILTIN_WORDS[slot - 1];
+    if (str_len(builtin->name) != str_len(word) ||
+        memcmp(builtin->name.ptr, word.ptr, str_len(word)) != 0) {
+        return NULL;
+    }
+    return builtin;
+}
+
+BuiltinCallback* builtin_lookup(str word) {
+    const BuiltinWord* builtin = find_builtin(word);
+    return builtin != NULL ? builtin->callback : NULL;
+}
+
+bool builtin_is_stateless(str word) {
+    const BuiltinWord* builtin = find_builtin(word);
+    return builtin != NULL && builtin->stateless;
+}
@@ -0,0 +1,17 @@
+#ifndef BUILTIN_H_
+#define BUILTIN_H_
+
+#include <stdbool.h>
+#include <str/str.h>
+
+#include "ast.h"
+
+typedef int BuiltinCallback(WordList argv);
+
+// Returns the callback for a builtin command, or NULL if word is not one.
+BuiltinCallback* builtin_lookup(str word);
+// Whether word is a builtin that leaves the shell's state alone, so that
+// running it in-process is the same as running it in a subshell.
+bool builtin_is_stateless(str word);
+
+#endif  // BUILTIN_H_
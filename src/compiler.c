@@ -0,0 +1,169 @@
+#include "compiler.h"
+
+#include <stdlib.h>
+
+#include "lexer.h"
+
+typedef struct {
+    const SyntaxTree* tree;
+    Arena* arena;
+    InstructionBuf code;
+} Compiler;
+
+static void compile_statements(Compiler* compiler, AstSpan lists, bool tail);
+static void compile_list(Compiler* compiler, AstSpan list, bool tail);
+static void compile_command(Compiler* compiler, AstCommand command, bool tail);
+
+static uint32_t emit(Compiler* compiler, Instruction instruction) {
+    ARENA_BUF_PUSH(compiler->arena, &compiler->code, instruction);
+    return (uint32_t)compiler->code.len - 1;
+}
+
+static uint32_t next_index(const Compiler* compiler) {
+    return (uint32_t)compiler->code.len;
+}
+
+Program compile_tree(const SyntaxTree* tree, Arena* arena, bool tail) {
+    Compiler compiler = {.tree = tree, .arena = arena, .code = BUF_NEW};
+    compile_statements(&compiler, tree->root, tail);
+    emit(&compiler, (Instruction){.opcode = tail ? OPCODE_EXIT : OPCODE_HALT});
+    return (Program){
+        .code = compiler.code,
+        .words = tree->words,
+        .redirections = tree->redirections,
+    };
+}
+
+static void compile_statements(Compiler* compiler, AstSpan lists, bool tail) {
+    for (uint32_t i = 0; i < lists.len; i++) {
+        AstSpan list = compiler->tree->lists.ptr[lists.start + i];
+        compile_list(compiler, list, tail && i == lists.len - 1);
+    }
+}
+
+static void compile_list(Compiler* compiler, AstSpan list, bool tail) {
+    // a short-circuiting operator skips the rest of its list
+    BUF(uint32_t) jumps = BUF_NEW;
+    for (uint32_t i = list.start; i < list.start + list.len; i++) {
+        Op op = compiler->tree->ops.ptr[i];
+        compile_command(compiler, compiler->tree->commands.ptr[i], tail && op == OP_END);
+        switch (op) {
+            case OP_AND:
+                ARENA_BUF_PUSH(
+                    compiler->arena,
+                    &jumps,
+                    emit(compiler, (Instruction){.opcode = OPCODE_JUMP_IF_FAIL})
+                );
+                break;
+            case OP_OR:
+                ARENA_BUF_PUSH(
+                    compiler->arena,
+                    &jumps,
+                    emit(compiler, (Instruction){.opcode = OPCODE_JUMP_IF_OK})
+                );
+                break;
+            case OP_END:
+                break;
+            default:
+                abort();
+        }
+    }
+
+    uint32_t end = next_index(compiler);
+    for (uint64_t i = 0; i < jumps.len; i++) {
+        compiler->code.ptr[jumps.ptr[i]].arg.target = end;
+    }
+}
+
+// Whether a simple command can be spawned without a copy of the shell: it is
+// not a builtin, and its name is not only known once it has been expanded.
+static bool spawnable(const Compiler* compiler, AstCommand command) {
+    str name = compiler->tree->words.ptr[command.span.start];
+    return builtin_lookup(name) == NULL && !word_has_substitution(name);
+}
+
+static void compile_stage(Compiler* compiler, AstCommand stage) {
+    if (stage.type == COMMAND_TYPE_SIMPLE && !stage.negated) {
+        if (spawnable(compiler, stage)) {
+            // no need for a copy of the shell; the child can be spawned directly
+            emit(
+                compiler,
+                (Instruction){
+                    .opcode = OPCODE_PIPE_SPAWN,
+                    .expands = stage.expands,
+                    .arg.words = stage.span,
+                    .redirections = stage.redirections,
+                }
+            );
+            return;
+        }
+    }
+    uint32_t enter = emit(compiler, (Instruction){.opcode = OPCODE_PIPE_FORK});
+    compile_command(compiler, stage, true);
+    emit(compiler, (Instruction){.opcode = OPCODE_EXIT});
+    compiler->code.ptr[enter].arg.target = next_index(compiler);
+}
+
+static void compile_command(Compiler* compiler, AstCommand command, bool tail) {
+    switch (command.type) {
+        case COMMAND_TYPE_SIMPLE: {
+            Instruction instruction = {
+                .opcode = OPCODE_EXTERNAL,
+                .negated = command.negated,
+                .expands = command.expands,
+                .arg.words = command.span,
+                .redirections = command.redirections,
+                .builtin = builtin_lookup(compiler->tree->words.ptr[command.span.start]),
+            };
+            if (instruction.builtin != NULL) {
+                instruction.opcode = OPCODE_BUILTIN;
+            } else if (tail && !command.negated) {
+                // a negated status still has to be computed by this process
+                instruction.opcode = OPCODE_EXEC;
+            }
+            emit(compiler, instruction);
+            break;
+        }
+        case COMMAND_TYPE_SUBSHELL:
+            if (tail) {
+                // the process exits right after, so it can host the body itself
+                compile_statements(compiler, command.span, true);
+                break;
+            }
+            uint32_t enter = emit(compiler, (Instruction){.opcode = OPCODE_SUBSHELL});
+            compile_statements(compiler, command.span, true);
+            emit(compiler, (Instruction){.opcode = OPCODE_EXIT});
+            compiler->code.ptr[enter].arg.target = next_index(compiler);
+            break;
+        case COMMAND_TYPE_BACKGROUND: {
+            AstSpan list = compiler->tree->lists.ptr[command.span.start];
+            AstCommand first = compiler->tree->commands.ptr[list.start];
+            // a job's substitutions are left to the copy of the shell to reap
+            if (list.len == 1 && first.type == COMMAND_TYPE_SIMPLE && !first.negated &&
+                !first.expands && spawnable(compiler, first)) {
+                emit(
+                    compiler,
+                    (Instruction){
+                        .opcode = OPCODE_BG_SPAWN,
+                        .arg.words = first.span,
+                        .redirections = first.redirections,
+                    }
+                );
+                break;
+            }
+            uint32_t enter = emit(compiler, (Instruction){.opcode = OPCODE_BG_FORK});
+            compile_statements(compiler, command.span, true);
+            emit(compiler, (Instruction){.opcode = OPCODE_EXIT});
+            compiler->code.ptr[enter].arg.target = next_index(compiler);
+            break;
+        }
+        case COMMAND_TYPE_PIPELINE:
+            for (uint32_t i = command.span.start; i < command.span.start + command.span.len; i++) {
+                compile_stage(compiler, compiler->tree->commands.ptr[i]);
+            }
+            emit(compiler, (Instruction){.opcode = OPCODE_PIPE_WAIT, .negated = command.negated});
+            break;
+        default:
+            abort();
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef COMPILER_H_
+#define COMPILER_H_
+
+#include <arena/arena.h>
+#include <stdint.h>
+
+#include "ast.h"
+#include "builtin.h"
+
+typedef enum {
+#define X(x) OPCODE_##x,
+#include "opcode.inc"
+#undef X
+} Opcode;
+
+// BUILTIN, EXTERNAL: run `words` and set the status (inverted if `negated`).
+// EXEC: replace the process with `words`.
+// These and PIPE_SPAWN, BG_SPAWN apply `redirections` to the command; a
+// builtin's are undone once it returns. With `expands`, their words and paths
+// go through substitution first, and EXTERNAL and EXEC run a builtin if that
+// is what the first word turns into.
+// SUBSHELL: fork; the child continues with the next instruction, the parent
+//   waits for it and continues at `target` with its status.
+// PIPE_SPAWN, PIPE_FORK: start a pipeline stage, connected to the previous
+//   stage and, unless the next stage instruction is PIPE_WAIT, to the next.
+//   PIPE_SPAWN starts external `words`. PIPE_FORK forks; the child continues
+//   with the next instruction and the parent continues at `target`.
+// PIPE_WAIT: wait for every stage and set the status to the last one's.
+// BG_SPAWN: start external `words`, which don't expand, as a background job.
+// BG_FORK: fork a background job; the child continues with the next
+//   instruction and the parent continues at `target`.
+// EXIT: exit the process with the current status.
+// JUMP_IF_FAIL, JUMP_IF_OK: continue at `target` if the status is (non)zero.
+// HALT: stop and return the current status.
+typedef struct {
+    Opcode opcode;
+    bool negated;
+    bool expands;
+    union {
+        AstSpan words;
+        uint32_t target;
+    } arg;
+    AstSpan redirections;
+    BuiltinCallback* builtin;
+} Instruction;
+
+typedef BUF(Instruction) InstructionBuf;
+
+// A compiled tree. Instructions refer to the tree's words and redirections, so
+// a program stays valid for as long as the tree does and can be run any number
+// of times.
+typedef struct {
+    InstructionBuf code;
+    WordList words;
+    AstRedirectionBuf redirections;
+} Program;
+
+// Lowers tree into a flat instruction stream allocated from arena. With
+// `tail`, the program ends by exiting instead of halting, and its final
+// external command is exec'd in place.
+Program compile_tree(const SyntaxTree* tree, Arena* arena, bool tail);
+
+#endif  // COMPILER_H_
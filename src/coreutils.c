@@ -0,0 +1,812 @@
+#include "coreutils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <println/println.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <str/strtox.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spawn.h"
+
+// Output goes through stdio's stdout buffer; spawning and forking flush it.
+
+static bool parse_integer(str word, int64_t* out) {
+    word = str_trim(word, str_lit(" \t\n"));
+    bool negative = false;
+    if (str_has_prefix(word, str_lit("-"))) {
+        negative = true;
+        word = str_after(word, 1);
+    } else if (str_has_prefix(word, str_lit("+"))) {
+        word = str_after(word, 1);
+    }
+    Str2I64Result result = str2i64(word, 10);
+    if (str_is_empty(word) || result.err || result.endptr != str_end(word)) {
+        return false;
+    }
+    *out = negative ? -result.value : result.value;
+    return true;
+}
+
+int true_command(WordList argv) {
+    (void)argv;
+    return 0;
+}
+
+int false_command(WordList argv) {
+    (void)argv;
+    return 1;
+}
+
+int echo_command(WordList argv) {
+    uint64_t first = 1;
+    bool newline = true;
+    if (argv.len > 1 && str_eq(argv.ptr[1], str_lit("-n"))) {
+        newline = false;
+        first = 2;
+    }
+    for (uint64_t i = first; i < argv.len; i++) {
+        if (i > first) {
+            putchar(' ');
+        }
+        fwrite(str_ptr(argv.ptr[i]), 1, str_len(argv.ptr[i]), stdout);
+    }
+    if (newline) {
+        putchar('\n');
+    }
+    return 0;
+}
+
+int pwd_command(WordList argv) {
+    (void)argv;
+    char* cwd = getcwd(NULL, 0);
+    if (cwd == NULL) {
+        fprintfln(stderr, "pwd: %s", strerror(errno));
+        return 1;
+    }
+    printfln("%s", cwd);
+    free(cwd);
+    return 0;
+}
+
+// Longest accepted duration, a little under 32 years. Anything longer is as
+// good as forever and would only risk overflowing a timespec.
+#define MAX_DURATION 1e9
+
+// Parses a duration like `1.5`, `30s`, `2m`, `1h` or `1d` into seconds.
+// Rejects inf, nan and anything over MAX_DURATION.
+static bool parse_duration(str word, double* seconds) {
+    str copy = str_dup(word);
+    char* end;
+    double value = strtod(str_ptr(copy), &end);
+    double multiplier = 1;
+    switch (*end) {
+        case 'd':
+            multiplier *= 24;
+            // fallthrough
+        case 'h':
+            multiplier *= 60;
+            // fallthrough
+        case 'm':
+            multiplier *= 60;
+            // fallthrough
+        case 's':
+            end++;
+            break;
+        default:
+            break;
+    }
+    *seconds = value * multiplier;
+    bool valid = end != copy.ptr && *end == '\0' && isfinite(*seconds) && *seconds >= 0 &&
+                 *seconds <= MAX_DURATION;
+    str_free(copy);
+    return valid;
+}
+
+static struct timespec deadline_after(double seconds) {
+    // sleep adds up its operands, which may go over on their own
+    if (seconds > MAX_DURATION) {
+        seconds = MAX_DURATION;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    time_t whole = (time_t)seconds;
+    deadline.tv_sec += whole;
+    deadline.tv_nsec += (long)((seconds - (double)whole) * 1e9);
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+int sleep_command(WordList argv) {
+    if (argv.len < 2) {
+        fprintfln(stderr, "sleep: missing operand");
+        return 1;
+    }
+
+    double seconds = 0;
+    for (uint64_t i = 1; i < argv.len; i++) {
+        double value;
+        if (!parse_duration(argv.ptr[i], &value)) {
+            fprintfln(stderr, "sleep: invalid time interval '" str_fmt "'", str_arg(argv.ptr[i]));
+            return 1;
+        }
+        seconds += value;
+    }
+
+    struct timespec deadline = deadline_after(seconds);
+    fflush(stdout);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+    return 0;
+}
+
+// timeout
+
+#define TIMEOUT_STATUS 124
+#define TIMEOUT_FAILED 125
+#define TIMEOUT_DEFAULT_GRACE 5.0
+
+typedef struct {
+    str name;
+    int number;
+} SignalName;
+
+static const SignalName SIGNAL_NAMES[] = {
+    {str_lit_c("HUP"), SIGHUP},
+    {str_lit_c("INT"), SIGINT},
+    {str_lit_c("QUIT"), SIGQUIT},
+    {str_lit_c("KILL"), SIGKILL},
+    {str_lit_c("USR1"), SIGUSR1},
+    {str_lit_c("USR2"), SIGUSR2},
+    {str_lit_c("ALRM"), SIGALRM},
+    {str_lit_c("TERM"), SIGTERM},
+};
+
+static bool parse_signal(str word, int* out) {
+    if (str_has_prefix(word, str_lit("SIG"))) {
+        word = str_after(word, 3);
+    }
+    for (size_t i = 0; i < sizeof(SIGNAL_NAMES) / sizeof(SIGNAL_NAMES[0]); i++) {
+        if (str_eq(SIGNAL_NAMES[i].name, word)) {
+            *out = SIGNAL_NAMES[i].number;
+            return true;
+        }
+    }
+    int64_t number;
+    if (!parse_integer(word, &number) || number <= 0 || number >= NSIG) {
+        return false;
+    }
+    *out = (int)number;
+    return true;
+}
+
+static int send_signal(pid_t pid, int pidfd, int sig) {
+    if (pidfd != -1) {
+        // can't hit a recycled pid, unlike kill()
+        return (int)syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+    }
+    return kill(pid, sig);
+}
+
+// Waits for the child until the deadline, or forever without one. Returns
+// false if the deadline passed first.
+static bool wait_until(pid_t pid, int pidfd, const struct timespec* deadline, int* status) {
+    while (true) {
+        siginfo_t info = {0};
+        if (waitid(P_PID, (id_t)pid, &info, WEXITED | WNOHANG) == 0 && info.si_pid != 0) {
+            *status = process_status(&info);
+            return true;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        struct timespec remaining = {0, 0};
+        if (deadline != NULL) {
+            remaining.tv_sec = deadline->tv_sec - now.tv_sec;
+            remaining.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+            if (remaining.tv_nsec < 0) {
+                remaining.tv_sec--;
+                remaining.tv_nsec += 1000000000L;
+            }
+            if (remaining.tv_sec < 0) {
+                return false;
+            }
+        }
+        if (pidfd == -1) {
+            // without a pidfd there is nothing to sleep on, so check back
+            struct timespec tick = {0, 10000000L};
+            if (deadline == NULL || remaining.tv_sec > 0 || remaining.tv_nsec > tick.tv_nsec) {
+                remaining = tick;
+            }
+            nanosleep(&remaining, NULL);
+            continue;
+        }
+        struct pollfd fd = {.fd = pidfd, .events = POLLIN};
+        ppoll(&fd, 1, deadline != NULL ? &remaining : NULL, NULL);
+    }
+}
+
+// timeout [-s SIGNAL] [-k DURATION] DURATION command [arg...]
+//
+// Runs the command and sends it SIGNAL (TERM by default) if it is still
+// running after DURATION, then KILL if it outlives the grace period given
+// with -k (5s by default; 0 disables it). Returns 124 if the command timed
+// out, or 137 if it had to be killed.
+int timeout_command(WordList argv) {
+    int sig = SIGTERM;
+    double grace = TIMEOUT_DEFAULT_GRACE;
+    uint64_t i = 1;
+    for (; i + 1 < argv.len && str_has_prefix(argv.ptr[i], str_lit("-")); i += 2) {
+        str option = argv.ptr[i];
+        str value = argv.ptr[i + 1];
+        if (str_eq(option, str_lit("-s"))) {
+            if (!parse_signal(value, &sig)) {
+                fprintfln(stderr, "timeout: invalid signal '" str_fmt "'", str_arg(value));
+                return TIMEOUT_FAILED;
+            }
+        } else if (str_eq(option, str_lit("-k"))) {
+            if (!parse_duration(value, &grace)) {
+                fprintfln(stderr, "timeout: invalid time interval '" str_fmt "'", str_arg(value));
+                return TIMEOUT_FAILED;
+            }
+        } else {
+            fprintfln(stderr, "timeout: unknown option '" str_fmt "'", str_arg(option));
+            return TIMEOUT_FAILED;
+        }
+    }
+    if (i + 1 >= argv.len) {
+        fprintfln(stderr, "timeout: usage: timeout [-s SIGNAL] [-k DURATION] DURATION command");
+        return TIMEOUT_FAILED;
+    }
+    double seconds;
+    if (!parse_duration(argv.ptr[i], &seconds)) {
+        fprintfln(stderr, "timeout: invalid time interval '" str_fmt "'", str_arg(argv.ptr[i]));
+        return TIMEOUT_FAILED;
+    }
+
+    // the deadline runs from before the spawn, so it bounds the whole command
+    struct timespec deadline = deadline_after(seconds);
+    WordList command = BUF_SHIFTED(argv, i + 1);
+    SpawnDupList dups = BUF_NEW;
+    pid_t pid = spawn_process(command, dups);
+    if (pid == -1) {
+        return 127;
+    }
+    int pidfd = process_pidfd(pid);
+    int status;
+    // a duration of zero means no timeout
+    if (wait_until(pid, pidfd, seconds > 0 ? &deadline : NULL, &status)) {
+        if (pidfd != -1) {
+            close(pidfd);
+        }
+        return status;
+    }
+
+    send_signal(pid, pidfd, sig);
+    status = TIMEOUT_STATUS;
+    struct timespec kill_deadline = deadline_after(grace);
+    int ignored;
+    if (grace == 0) {
+        wait_until(pid, pidfd, NULL, &ignored);
+    } else if (!wait_until(pid, pidfd, &kill_deadline, &ignored)) {
+        send_signal(pid, pidfd, SIGKILL);
+        status = 128 + SIGKILL;
+        wait_until(pid, pidfd, NULL, &ignored);
+    }
+    if (pidfd != -1) {
+        close(pidfd);
+    }
+    return status;
+}
+
+// printf
+
+typedef struct {
+    WordList args;
+    uint64_t next;
+} PrintfArgs;
+
+static str next_arg(PrintfArgs* args) {
+    if (args->next >= args->args.len) {
+        return str_null;
+    }
+    return args->args.ptr[args->next++];
+}
+
+static bool is_octal(char c) {
+    return c >= '0' && c <= '7';
+}
+
+// Writes the escape sequence starting at s[i] (just after the backslash) and
+// returns the index after it. In %b arguments octal escapes take a leading 0
+// and \c stops all further output.
+static size_t write_escape(str s, size_t i, bool in_arg, bool* stop) {
+    char c = str_getc(s, i);
+    switch (c) {
+        case 'a':
+            putchar('\a');
+            return i + 1;
+        case 'b':
+            putchar('\b');
+            return i + 1;
+        case 'f':
+            putchar('\f');
+            return i + 1;
+        case 'n':
+            putchar('\n');
+            return i + 1;
+        case 'r':
+            putchar('\r');
+            return i + 1;
+        case 't':
+            putchar('\t');
+            return i + 1;
+        case 'v':
+            putchar('\v');
+            return i + 1;
+        case '\\':
+            putchar('\\');
+            return i + 1;
+        case 'c':
+            if (in_arg) {
+                *stop = true;
+                return str_len(s);
+            }
+            break;
+        default:
+            break;
+    }
+    if (is_octal(c)) {
+        size_t start = i;
+        if (in_arg && c == '0') {
+            start++;
+        }
+        int value = 0;
+        size_t end = start;
+        while (end < str_len(s) && end < start + 3 && is_octal(s.ptr[end])) {
+            value = value * 8 + (s.ptr[end] - '0');
+            end++;
+        }
+        putchar(value);
+        return end;
+    }
+    putchar('\\');
+    if (i < str_len(s)) {
+        putchar(c);
+        return i + 1;
+    }
+    return i;
+}
+
+static bool write_escaped(str s, bool in_arg) {
+    bool stop = false;
+    for (size_t i = 0; i < str_len(s) && !stop;) {
+        if (s.ptr[i] == '\\') {
+            i = write_escape(s, i + 1, in_arg, &stop);
+        } else {
+            putchar(s.ptr[i++]);
+        }
+    }
+    return stop;
+}
+
+static bool printf_number(str word, intmax_t* out) {
+    if (str_is_empty(word)) {
+        *out = 0;
+        return true;
+    }
+    if ((word.ptr[0] == '\'' || word.ptr[0] == '"') && str_len(word) > 1) {
+        *out = (unsigned char)word.ptr[1];
+        return true;
+    }
+    int64_t value;
+    if (!parse_integer(word, &value)) {
+        fprintfln(stderr, "printf: '" str_fmt "': expected a numeric value", str_arg(word));
+        *out = 0;
+        return false;
+    }
+    *out = value;
+    return true;
+}
+
+// Formats one pass over the format string. Returns false on a conversion
+// error; sets *stop when \c was seen.
+static bool printf_once(str format, PrintfArgs* args, bool* stop) {
+    bool ok = true;
+    for (size_t i = 0; i < str_len(format) && !*stop;) {
+        char c = format.ptr[i];
+        if (c == '\\') {
+            i = write_escape(format, i + 1, false, stop);
+            continue;
+        }
+        if (c != '%') {
+            putchar(c);
+            i++;
+            continue;
+        }
+        if (str_getc(format, i + 1) == '%') {
+            putchar('%');
+            i += 2;
+            continue;
+        }
+
+        // rebuild the conversion for the C library, resolving '*' from args
+        char spec[64] = "%";
+        size_t spec_len = 1;
+        size_t j = i + 1;
+        while (j < str_len(format) && strchr("-+ #0", format.ptr[j]) != NULL && spec_len < 8) {
+            spec[spec_len++] = format.ptr[j++];
+        }
+        for (int part = 0; part < 2; part++) {
+            if (part == 1) {
+                if (str_getc(format, j) != '.') {
+                    break;
+                }
+                spec[spec_len++] = '.';
+                j++;
+            }
+            if (str_getc(format, j) == '*') {
+                intmax_t n;
+                ok = printf_number(next_arg(args), &n) && ok;
+                spec_len += (size_t)snprintf(spec + spec_len, 24, "%d", (int)n);
+                j++;
+            } else {
+                while (j < str_len(format) && format.ptr[j] >= '0' && format.ptr[j] <= '9' &&
+                       spec_len < 40) {
+                    spec[spec_len++] = format.ptr[j++];
+                }
+            }
+        }
+
+        char conversion = str_getc(format, j);
+        i = j + 1;
+        switch (conversion) {
+            case 'd':
+            case 'i':
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X': {
+                intmax_t n;
+                ok = printf_number(next_arg(args), &n) && ok;
+                spec[spec_len++] = 'j';
+                spec[spec_len++] = conversion;
+                spec[spec_len] = '\0';
+                printf(spec, n);
+                break;
+            }
+            case 'c': {
+                str arg = next_arg(args);
+                spec[spec_len++] = 'c';
+                spec[spec_len] = '\0';
+                printf(spec, str_is_empty(arg) ? '\0' : arg.ptr[0]);
+                break;
+            }
+            case 's': {
+                str arg = str_dup(next_arg(args));
+                spec[spec_len++] = 's';
+                spec[spec_len] = '\0';
+                printf(spec, str_ptr(arg));
+                str_free(arg);
+                break;
+            }
+            case 'b':
+                *stop = write_escaped(next_arg(args), true);
+                break;
+            default:
+                fprintfln(stderr, "printf: invalid conversion '%%%c'", conversion);
+                return false;
+        }
+    }
+    return ok;
+}
+
+int printf_command(WordList argv) {
+    if (argv.len < 2) {
+        fprintfln(stderr, "printf: missing format");
+        return 1;
+    }
+
+    PrintfArgs args = {.args = BUF_SHIFTED(argv, 2), .next = 0};
+    bool ok = true;
+    bool stop = false;
+    // the format is reused while it keeps consuming arguments
+    do {
+        uint64_t before = args.next;
+        ok = printf_once(argv.ptr[1], &args, &stop) && ok;
+        if (args.next == before) {
+            break;
+        }
+    } while (args.next < args.args.len && !stop);
+    return !ok;
+}
+
+// test
+
+typedef struct {
+    WordList argv;
+    uint64_t pos;
+    bool error;
+} TestParser;
+
+static bool test_file(char op, str operand) {
+    str path = str_dup(operand);
+    struct stat st;
+    bool result;
+    if (op == 'L' || op == 'h') {
+        result = lstat(str_ptr(path), &st) == 0 && S_ISLNK(st.st_mode);
+        str_free(path);
+        return result;
+    }
+    if (op == 'r' || op == 'w' || op == 'x') {
+        int mode = op == 'r' ? R_OK : op == 'w' ? W_OK : X_OK;
+        result = faccessat(AT_FDCWD, str_ptr(path), mode, AT_EACCESS) == 0;
+        str_free(path);
+        return result;
+    }
+    bool exists = stat(str_ptr(path), &st) == 0;
+    str_free(path);
+    if (!exists) {
+        return false;
+    }
+    switch (op) {
+        case 'e':
+            return true;
+        case 'f':
+            return S_ISREG(st.st_mode);
+        case 'd':
+            return S_ISDIR(st.st_mode);
+        case 'b':
+            return S_ISBLK(st.st_mode);
+        case 'c':
+            return S_ISCHR(st.st_mode);
+        case 'p':
+            return S_ISFIFO(st.st_mode);
+        case 'S':
+            return S_ISSOCK(st.st_mode);
+        case 's':
+            return st.st_size > 0;
+        case 'u':
+            return (st.st_mode & S_ISUID) != 0;
+        case 'g':
+            return (st.st_mode & S_ISGID) != 0;
+        default:
+            abort();
+    }
+}
+
+static bool is_unary_op(str word) {
+    return str_len(word) == 2 && word.ptr[0] == '-' &&
+           strchr("nzefdbcpSsugrwxLht", word.ptr[1]) != NULL;
+}
+
+static bool test_unary(TestParser* parser, char op, str operand) {
+    switch (op) {
+        case 'n':
+            return !str_is_empty(operand);
+        case 'z':
+            return str_is_empty(operand);
+        case 't': {
+            int64_t fd;
+            if (!parse_integer(operand, &fd)) {
+                fprintfln(stderr, "test: " str_fmt ": integer expected", str_arg(operand));
+                parser->error = true;
+                return false;
+            }
+            return isatty((int)fd);
+        }
+        default:
+            return test_file(op, operand);
+    }
+}
+
+typedef enum {
+    TEST_OP_STR_EQ,
+    TEST_OP_STR_NE,
+    TEST_OP_EQ,
+    TEST_OP_NE,
+    TEST_OP_LT,
+    TEST_OP_LE,
+    TEST_OP_GT,
+    TEST_OP_GE,
+    TEST_OP_NEWER,
+    TEST_OP_OLDER,
+    TEST_OP_SAME_FILE,
+    TEST_OP_NONE,
+} TestBinaryOp;
+
+static const str TEST_BINARY_OPS[] = {
+    [TEST_OP_STR_EQ] = str_lit_c("="),
+    [TEST_OP_STR_NE] = str_lit_c("!="),
+    [TEST_OP_EQ] = str_lit_c("-eq"),
+    [TEST_OP_NE] = str_lit_c("-ne"),
+    [TEST_OP_LT] = str_lit_c("-lt"),
+    [TEST_OP_LE] = str_lit_c("-le"),
+    [TEST_OP_GT] = str_lit_c("-gt"),
+    [TEST_OP_GE] = str_lit_c("-ge"),
+    [TEST_OP_NEWER] = str_lit_c("-nt"),
+    [TEST_OP_OLDER] = str_lit_c("-ot"),
+    [TEST_OP_SAME_FILE] = str_lit_c("-ef"),
+};
+
+static TestBinaryOp test_binary_op(str word) {
+    for (int i = 0; i < TEST_OP_NONE; i++) {
+        if (str_eq(TEST_BINARY_OPS[i], word)) {
+            return (TestBinaryOp)i;
+        }
+    }
+    return TEST_OP_NONE;
+}
+
+static bool timespec_after(struct timespec a, struct timespec b) {
+    return a.tv_sec > b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec > b.tv_nsec);
+}
+
+static bool test_files(str lhs, TestBinaryOp op, str rhs) {
+    str lhs_path = str_dup(lhs);
+    str rhs_path = str_dup(rhs);
+    struct stat lhs_st;
+    struct stat rhs_st;
+    bool lhs_ok = stat(str_ptr(lhs_path), &lhs_st) == 0;
+    bool rhs_ok = stat(str_ptr(rhs_path), &rhs_st) == 0;
+    str_free(lhs_path);
+    str_free(rhs_path);
+    switch (op) {
+        case TEST_OP_NEWER:
+            return lhs_ok && (!rhs_ok || timespec_after(lhs_st.st_mtim, rhs_st.st_mtim));
+        case TEST_OP_OLDER:
+            return rhs_ok && (!lhs_ok || timespec_after(rhs_st.st_mtim, lhs_st.st_mtim));
+        case TEST_OP_SAME_FILE:
+            return lhs_ok && rhs_ok && lhs_st.st_dev == rhs_st.st_dev &&
+                   lhs_st.st_ino == rhs_st.st_ino;
+        default:
+            abort();
+    }
+}
+
+static bool test_binary(TestParser* parser, str lhs, TestBinaryOp op, str rhs) {
+    switch (op) {
+        case TEST_OP_STR_EQ:
+            return str_eq(lhs, rhs);
+        case TEST_OP_STR_NE:
+            return !str_eq(lhs, rhs);
+        case TEST_OP_NEWER:
+        case TEST_OP_OLDER:
+        case TEST_OP_SAME_FILE:
+            return test_files(lhs, op, rhs);
+        default:
+            break;
+    }
+
+    int64_t a;
+    int64_t b;
+    if (!parse_integer(lhs, &a) || !parse_integer(rhs, &b)) {
+        fprintfln(stderr, "test: integer expression expected");
+        parser->error = true;
+        return false;
+    }
+    switch (op) {
+        case TEST_OP_EQ:
+            return a == b;
+        case TEST_OP_NE:
+            return a != b;
+        case TEST_OP_LT:
+            return a < b;
+        case TEST_OP_LE:
+            return a <= b;
+        case TEST_OP_GT:
+            return a > b;
+        case TEST_OP_GE:
+            return a >= b;
+        default:
+            abort();
+    }
+}
+
+static uint64_t test_remaining(const TestParser* parser) {
+    return parser->argv.len - parser->pos;
+}
+
+static str test_peek(const TestParser* parser, uint64_t n) {
+    return parser->pos + n < parser->argv.len ? parser->argv.ptr[parser->pos + n] : str_null;
+}
+
+static bool test_or(TestParser* parser);
+
+static bool test_primary(TestParser* parser) {
+    if (test_remaining(parser) == 0) {
+        fprintfln(stderr, "test: argument expected");
+        parser->error = true;
+        return false;
+    }
+
+    str word = test_peek(parser, 0);
+    // a binary operator in second place wins over everything else
+    if (test_remaining(parser) >= 3) {
+        TestBinaryOp op = test_binary_op(test_peek(parser, 1));
+        if (op != TEST_OP_NONE) {
+            str rhs = test_peek(parser, 2);
+            parser->pos += 3;
+            return test_binary(parser, word, op, rhs);
+        }
+    }
+    if (str_eq(word, str_lit("!"))) {
+        parser->pos++;
+        return !test_primary(parser);
+    }
+    if (str_eq(word, str_lit("(")) && test_remaining(parser) >= 2) {
+        parser->pos++;
+        bool result = test_or(parser);
+        if (!str_eq(test_peek(parser, 0), str_lit(")"))) {
+            fprintfln(stderr, "test: ')' expected");
+            parser->error = true;
+            return false;
+        }
+        parser->pos++;
+        return result;
+    }
+    if (is_unary_op(word) && test_remaining(parser) >= 2) {
+        str operand = test_peek(parser, 1);
+        parser->pos += 2;
+        return test_unary(parser, word.ptr[1], operand);
+    }
+    parser->pos++;
+    return !str_is_empty(word);
+}
+
+static bool test_and(TestParser* parser) {
+    bool result = test_primary(parser);
+    while (test_remaining(parser) > 0 && str_eq(test_peek(parser, 0), str_lit("-a"))) {
+        parser->pos++;
+        result = test_primary(parser) && result;
+    }
+    return result;
+}
+
+static bool test_or(TestParser* parser) {
+    bool result = test_and(parser);
+    while (test_remaining(parser) > 0 && str_eq(test_peek(parser, 0), str_lit("-o"))) {
+        parser->pos++;
+        result = test_and(parser) || result;
+    }
+    return result;
+}
+
+static int run_test(WordList args) {
+    if (args.len == 0) {
+        return 1;
+    }
+    TestParser parser = {.argv = args, .pos = 0, .error = false};
+    bool result = test_or(&parser);
+    if (!parser.error && test_remaining(&parser) > 0) {
+        fprintfln(stderr, "test: too many arguments");
+        parser.error = true;
+    }
+    return parser.error ? 2 : !result;
+}
+
+int test_command(WordList argv) {
+    WordList args = BUF_SHIFTED(argv, 1);
+    return run_test(args);
+}
+
+int bracket_command(WordList argv) {
+    if (!str_eq(BUF_LAST(argv), str_lit("]"))) {
+        fprintfln(stderr, "[: missing ']'");
+        return 2;
+    }
+    WordList args = BUF_SUB(argv, 1, argv.len - 2);
+    return run_test(args);
+}
@@ -0,0 +1,17 @@
+#ifndef COREUTILS_H_
+#define COREUTILS_H_
+
+#include "ast.h"
+
+// In-process versions of the utilities scripts call most often.
+int true_command(WordList argv);
+int false_command(WordList argv);
+int echo_command(WordList argv);
+int printf_command(WordList argv);
+int test_command(WordList argv);
+int bracket_command(WordList argv);
+int pwd_command(WordList argv);
+int sleep_command(WordList argv);
+int timeout_command(WordList argv);
+
+#endif  // COREUTILS_H_
@@ -1,187 +1,536 @@
 #include "executor.h"
 
-#include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <println/println.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include <stdnoreturn.h>
-#include <str/strtox.h>
 #include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
-typedef BUF(char*) RawWordList;
+#include "heredoc.h"
+#include "jobs.h"
+#include "lexer.h"
+#include "spawn.h"
+#include "substitution.h"
 
-typedef int BuiltinCallback(WordList argv);
+size_t pipe_capacity = 0;
 
+// The pipeline whose stages are being started.
 typedef struct {
-    str name;
-    BuiltinCallback* callback;
-} BuiltinWord;
-
-static noreturn void exec_process(WordList argv) {
-    RawWordList raw_argv = BUF_NEW;
-    for (uint64_t j = 0; j < argv.len; j++) {
-        str word_dup = str_dup(argv.ptr[j]);
-        BUF_PUSH(&raw_argv, HEDLEY_CONST_CAST(char*, word_dup.ptr));
-    }
-    BUF_PUSH(&raw_argv, NULL);
-    execvp(raw_argv.ptr[0], raw_argv.ptr);
-    printfln(str_fmt ": %s", str_arg(argv.ptr[0]), strerror(errno));
-    exit(1);
-}
-
-static int run_process(WordList argv, bool should_fork) {
-    if (should_fork) {
-        pid_t pid = fork();
-        if (pid == 0) {
-            exec_process(argv);
-        }
-        int status;
-        waitpid(pid, &status, 0);
-        return status;
-    }
+    PidBuf pids;
+    // read end of the pipe from the previous stage, or -1 for the first stage
+    int read_fd;
+} PipelineState;
 
-    exec_process(argv);
+// Creates the pipe after a stage, unless it is the last one. On failure, the
+// stage just writes to the shell's stdout.
+static void open_stage_pipe(bool last, int fds[2]) {
+    fds[0] = -1;
+    fds[1] = -1;
+    if (last) {
+        return;
+    }
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        fprintfln(stderr, "shlol: pipe: %s", strerror(errno));
+        fds[0] = -1;
+        fds[1] = -1;
+        return;
+    }
+    if (pipe_capacity > 0) {
+        // best effort; unprivileged users are capped at /proc/sys/fs/pipe-max-size
+        fcntl(fds[1], F_SETPIPE_SZ, (int)pipe_capacity);
+    }
 }
 
-static int cd_command(WordList argv) {
-    bool result = false;
-    if (argv.len == 1) {
-        chdir(getenv("HOME"));
-    } else if (argv.len == 2) {
-        str path = str_dup(argv.ptr[1]);
-        chdir(path.ptr);
-        str_free(path);
-    } else {
-        printfln("cd: too many arguments");
-        result = true;
+// Moves the pipeline on to the next stage once `pid` has been started.
+static void finish_stage(PipelineState* pipeline, pid_t pid, int fds[2]) {
+    BUF_PUSH(&pipeline->pids, pid);
+    if (pipeline->read_fd != -1) {
+        close(pipeline->read_fd);
     }
-    return result;
+    if (fds[1] != -1) {
+        close(fds[1]);
+    }
+    pipeline->read_fd = fds[0];
 }
 
-static int exit_command(WordList argv) {
-    if (argv.len == 1) {
-        exit(0);
+// What to set up in the next spawned command. Reused by every spawn.
+typedef struct {
+    SpawnDupList dups;
+    // descriptors opened for the child, to be closed once it has started
+    FdBuf owned;
+} SpawnSetup;
+
+static void spawn_setup_reset(SpawnSetup* setup) {
+    for (uint64_t i = 0; i < setup->owned.len; i++) {
+        close(setup->owned.ptr[i]);
     }
-    if (argv.len == 2) {
-        Str2I64Result status = str2i64(argv.ptr[1], 10);
-        if (status.err || status.endptr != str_end(argv.ptr[1])) {
-            printfln("exit: invalid argument");
-            return true;
-        }
-        status.value = status.value % 256;
-        exit((int)status.value);
+    setup->owned.len = 0;
+    setup->dups.len = 0;
+}
+
+// Passes the pipes of the last expansion's process substitutions on to the
+// next spawned command, which is all the shell needs them for.
+static void hand_down_substitutions(ProcessSubstitutions* processes, SpawnSetup* setup) {
+    for (uint64_t i = 0; i < processes->fds.len; i++) {
+        int fd = processes->fds.ptr[i];
+        BUF_PUSH(&setup->dups, ((SpawnDup){fd, fd}));
+        BUF_PUSH(&setup->owned, fd);
     }
+    processes->fds.len = 0;
+}
 
-    printfln("exit: too many arguments");
-    return true;
+// Closes the shell's ends of the process substitutions' pipes, so they see
+// EOF or EPIPE, and waits for them.
+static void reap_substitutions(ProcessSubstitutions* processes) {
+    for (uint64_t i = 0; i < processes->fds.len; i++) {
+        close(processes->fds.ptr[i]);
+    }
+    processes->fds.len = 0;
+    for (uint64_t i = 0; i < processes->pids.len; i++) {
+        waitpid(processes->pids.ptr[i], NULL, 0);
+    }
+    processes->pids.len = 0;
 }
 
-static int exec_command(WordList argv) {
-    WordList actual_argv = BUF_SHIFTED(argv, 1);
-    run_process(actual_argv, false);
-    // unreachable
-    abort();
+// Waits for pid and returns its shell status, which is 128 plus the signal if
+// it was killed.
+static int wait_status(pid_t pid) {
+    siginfo_t info;
+    if (waitid(P_PID, (id_t)pid, &info, WEXITED) == -1) {
+        return 1;
+    }
+    return process_status(&info);
 }
 
-static const BuiltinWord BUILTIN_WORDS[] = {
-    {str_lit_c("cd"), cd_command},
-    {str_lit_c("exit"), exit_command},
-    {str_lit_c("exec"), exec_command},
-};
+// Runs argv to completion, releasing what setup opened for it as soon as it
+// has started.
+static int run_process(WordList argv, SpawnSetup* setup) {
+    pid_t pid = spawn_process(argv, setup->dups);
+    spawn_setup_reset(setup);
+    if (pid < 0) {
+        return 1;
+    }
+    return wait_status(pid);
+}
 
+// What expanding the current command left behind.
 typedef struct {
-    bool is_builtin;
-    BuiltinCallback* cb;
-} IsBuiltinResult;
-
-static IsBuiltinResult is_builtin(str word) {
-    BUF(const BuiltinWord) builtin_words = BUF_ARRAY(BUILTIN_WORDS);
-    for (uint64_t i = 0; i < builtin_words.len; i++) {
-        if (str_eq(builtin_words.ptr[i].name, word)) {
-            return (IsBuiltinResult){true, builtin_words.ptr[i].callback};
-        }
-    }
+    // holds its expanded words; each command discards the last one's
+    Arena scratch;
+    ProcessSubstitutions processes;
+} Expansion;
 
-    return (IsBuiltinResult){false, NULL};
+// The instruction's words, expanded if need be.
+static WordList instruction_words(
+    const Program* program,
+    const Instruction* instruction,
+    Expansion* expansion
+) {
+    WordList words =
+        BUF_SUB(program->words, instruction->arg.words.start, instruction->arg.words.len);
+    arena_reset(&expansion->scratch);
+    if (!instruction->expands) {
+        return words;
+    }
+    return substitution_expand(words, &expansion->scratch, &expansion->processes);
 }
 
-static int execute_statements(Statements* statements);
-static int execute_list(CommandList list);
-static int execute_command(Command* command);
-static int execute_simple_command(SimpleCommand* command);
-static int execute_subshell_command(SubshellCommand* command);
+// The path a redirection names, expanded if need be. Returns false (after
+// reporting the error) unless it comes to a single field.
+static bool redirection_path(
+    const Program* program,
+    AstRedirection redirection,
+    Expansion* expansion,
+    str* path
+) {
+    WordList word = BUF_SUB(program->words, redirection.target, 1);
+    if (!word_has_substitution(word.ptr[0])) {
+        *path = word.ptr[0];
+        return true;
+    }
+    WordList fields = substitution_expand(word, &expansion->scratch, &expansion->processes);
+    if (fields.len != 1) {
+        fprintfln(stderr, "shlol: " str_fmt ": ambiguous redirect", str_arg(word.ptr[0]));
+        return false;
+    }
+    *path = fields.ptr[0];
+    return true;
+}
 
-int execute_tree(SyntaxTree tree) {
-    return execute_statements(tree.root);
+static int redirection_flags(RedirectType type) {
+    switch (type) {
+        case REDIRECT_INPUT:
+            return O_RDONLY;
+        case REDIRECT_OUTPUT:
+            return O_WRONLY | O_CREAT | O_TRUNC;
+        case REDIRECT_APPEND:
+            return O_WRONLY | O_CREAT | O_APPEND;
+        default:
+            abort();
+    }
 }
 
-static int execute_statements(Statements* statements) {
-    int result = 0;
-    for (uint64_t i = 0; i < statements->lists.len; i++) {
-        result = execute_list(statements->lists.ptr[i]);
+// Adds the instruction's redirections to setup. Files are opened by the child
+// itself. Returns false (after reporting the error) if a heredoc or path could
+// not be prepared.
+static bool push_redirections(
+    const Program* program,
+    const Instruction* instruction,
+    Expansion* expansion,
+    SpawnSetup* setup
+) {
+    AstSpan span = instruction->redirections;
+    for (uint32_t i = span.start; i < span.start + span.len; i++) {
+        AstRedirection redirection = program->redirections.ptr[i];
+        SpawnDup dup = {.from = (int)redirection.target, .to = redirection.fd};
+        switch (redirection.type) {
+            case REDIRECT_DUP:
+                break;
+            case REDIRECT_HEREDOC:
+            case REDIRECT_HERESTRING:
+                dup.from = heredoc_open(
+                    program->words.ptr[redirection.target],
+                    redirection.type == REDIRECT_HERESTRING
+                );
+                if (dup.from == -1) {
+                    return false;
+                }
+                BUF_PUSH(&setup->owned, dup.from);
+                break;
+            default:
+                if (!redirection_path(program, redirection, expansion, &dup.path)) {
+                    return false;
+                }
+                dup.flags = redirection_flags(redirection.type);
+                break;
+        }
+        BUF_PUSH(&setup->dups, dup);
     }
-    return result;
+    return true;
 }
 
-static int execute_list(CommandList list) {
-    assert(list.commands.len == 0 || list.commands.len - 1 == list.ops.len);
-    int result = 0;
-    for (uint64_t i = 0; i < list.commands.len; i++) {
-        result = execute_command(list.commands.ptr[i]);
-        if (list.ops.len > i) {
-            Op op = list.ops.ptr[i];
-            bool short_circuit;
-            switch (op) {
-                case OP_AND:
-                    short_circuit = result != 0;
-                    break;
-                case OP_OR:
-                    short_circuit = result == 0;
-                    break;
-                default:
-                    abort();
-            }
-            if (short_circuit) {
+// A descriptor replaced by a builtin's redirection, and a close-on-exec copy
+// of what it was before (-1 if it was closed).
+typedef struct {
+    int fd;
+    int saved;
+} SavedFd;
+
+typedef BUF(SavedFd) SavedFdBuf;
+
+// Applies the instruction's redirections to the shell itself. Unless `saved`
+// is NULL, the replaced descriptors are recorded there to be restored. Returns
+// false (after reporting the error) if one could not be applied.
+static bool redirect_in_process(
+    const Program* program,
+    const Instruction* instruction,
+    Expansion* expansion,
+    SavedFdBuf* saved
+) {
+    AstSpan span = instruction->redirections;
+    // output buffered so far belongs to the old stdout
+    fflush(stdout);
+    for (uint32_t i = span.start; i < span.start + span.len; i++) {
+        AstRedirection redirection = program->redirections.ptr[i];
+        if (saved != NULL) {
+            // kept clear of the low descriptors that redirections name
+            SavedFd entry = {redirection.fd, fcntl(redirection.fd, F_DUPFD_CLOEXEC, 10)};
+            BUF_PUSH(saved, entry);
+        }
+        int fd = (int)redirection.target;
+        switch (redirection.type) {
+            case REDIRECT_DUP:
+                if (fcntl(fd, F_GETFD) == -1) {
+                    fprintfln(stderr, "shlol: %d: %s", fd, strerror(errno));
+                    return false;
+                }
+                break;
+            case REDIRECT_HEREDOC:
+            case REDIRECT_HERESTRING:
+                fd = heredoc_open(
+                    program->words.ptr[redirection.target],
+                    redirection.type == REDIRECT_HERESTRING
+                );
+                if (fd == -1) {
+                    return false;
+                }
+                break;
+            default: {
+                str word;
+                if (!redirection_path(program, redirection, expansion, &word)) {
+                    return false;
+                }
+                str path = str_dup(word);
+                fd = open(str_ptr(path), redirection_flags(redirection.type) | O_CLOEXEC, 0666);
+                if (fd == -1) {
+                    fprintfln(stderr, "shlol: " str_fmt ": %s", str_arg(path), strerror(errno));
+                    str_free(path);
+                    return false;
+                }
+                str_free(path);
                 break;
             }
         }
-    }
 
-    return result;
+        if (fd == redirection.fd) {
+            // opened straight into place; it must survive exec
+            fcntl(fd, F_SETFD, 0);
+        } else {
+            dup2(fd, redirection.fd);
+            if (redirection.type != REDIRECT_DUP) {
+                close(fd);
+            }
+        }
+    }
+    return true;
 }
 
-static int execute_command(Command* command) {
-    switch (command->type) {
-        case COMMAND_TYPE_SIMPLE:
-            return execute_simple_command((SimpleCommand*)command);
-        case COMMAND_TYPE_SUBSHELL:
-            return execute_subshell_command((SubshellCommand*)command);
-        default:
-            abort();
+// Undoes redirect_in_process, most recent first.
+static void restore_redirections(SavedFdBuf* saved) {
+    fflush(stdout);
+    while (saved->len > 0) {
+        SavedFd entry = saved->ptr[--saved->len];
+        if (entry.saved == -1) {
+            close(entry.fd);
+            continue;
+        }
+        dup2(entry.saved, entry.fd);
+        close(entry.saved);
     }
 }
 
-static int execute_simple_command(SimpleCommand* command) {
-    IsBuiltinResult is_builtin_result = is_builtin(command->args.ptr[0]);
-    if (is_builtin_result.is_builtin) {
-        int result = is_builtin_result.cb(command->args);
-        return command->negated ? !result : result;
+static int run_builtin(
+    const Program* program,
+    const Instruction* instruction,
+    BuiltinCallback* builtin,
+    WordList args,
+    Expansion* expansion,
+    SavedFdBuf* saved
+) {
+    // what the builtin runs may need the substitutions' pipes too
+    ProcessSubstitutions* processes = &expansion->processes;
+    for (uint64_t i = 0; i < processes->fds.len; i++) {
+        fcntl(processes->fds.ptr[i], F_SETFD, 0);
+    }
+    if (instruction->redirections.len == 0) {
+        return builtin(args);
     }
+    int status = 1;
+    if (!redirect_in_process(program, instruction, expansion, saved)) {
+        restore_redirections(saved);
+        return status;
+    }
+    if (args.len == 1 && str_eq(args.ptr[0], str_lit("exec"))) {
+        // `exec` with only redirections applies them to the shell for good
+        while (saved->len > 0) {
+            SavedFd entry = saved->ptr[--saved->len];
+            if (entry.saved != -1) {
+                close(entry.saved);
+            }
+        }
+        return 0;
+    }
+    status = builtin(args);
+    restore_redirections(saved);
+    return status;
+}
 
-    int status = WEXITSTATUS(run_process(command->args, true));
-    return command->negated ? !status : status;
+// The builtin that an expanded command turned out to name, if any.
+static BuiltinCallback* expanded_builtin(const Instruction* instruction, WordList args) {
+    return instruction->expands && args.len > 0 ? builtin_lookup(args.ptr[0]) : NULL;
 }
 
-static int execute_subshell_command(SubshellCommand* command) {
-    pid_t pid = fork();
-    if (pid == 0) {
-        int result = execute_statements(command->statements);
-        exit(result);
+int execute_program(const Program* program) {
+    int status = 0;
+    uint32_t pc = 0;
+    PipelineState pipeline = {.pids = BUF_NEW, .read_fd = -1};
+    SpawnSetup setup = {.dups = BUF_NEW, .owned = BUF_NEW};
+    SavedFdBuf saved = BUF_NEW;
+    Expansion expansion = {.scratch = ARENA_NEW, .processes = {.fds = BUF_NEW, .pids = BUF_NEW}};
+    ProcessSubstitutions* processes = &expansion.processes;
+    while (true) {
+        const Instruction* instruction = &program->code.ptr[pc++];
+        switch (instruction->opcode) {
+            case OPCODE_BUILTIN: {
+                WordList args = instruction_words(program, instruction, &expansion);
+                status = run_builtin(
+                    program, instruction, instruction->builtin, args, &expansion, &saved
+                );
+                status = instruction->negated ? !status : status;
+                reap_substitutions(processes);
+                break;
+            }
+            case OPCODE_EXTERNAL: {
+                WordList args = instruction_words(program, instruction, &expansion);
+                BuiltinCallback* builtin = expanded_builtin(instruction, args);
+                if (args.len == 0) {
+                    // a command that expands to nothing does nothing
+                    status = 0;
+                } else if (builtin != NULL) {
+                    status = run_builtin(program, instruction, builtin, args, &expansion, &saved);
+                } else {
+                    status = 1;
+                    if (push_redirections(program, instruction, &expansion, &setup)) {
+                        hand_down_substitutions(processes, &setup);
+                        status = run_process(args, &setup);
+                    }
+                    spawn_setup_reset(&setup);
+                }
+                status = instruction->negated ? !status : status;
+                reap_substitutions(processes);
+                break;
+            }
+            case OPCODE_EXEC: {
+                WordList args = instruction_words(program, instruction, &expansion);
+                if (args.len == 0) {
+                    exit(0);
+                }
+                BuiltinCallback* builtin = expanded_builtin(instruction, args);
+                if (builtin != NULL) {
+                    exit(run_builtin(program, instruction, builtin, args, &expansion, &saved));
+                }
+                if (!redirect_in_process(program, instruction, &expansion, NULL)) {
+                    exit(1);
+                }
+                for (uint64_t i = 0; i < processes->fds.len; i++) {
+                    fcntl(processes->fds.ptr[i], F_SETFD, 0);
+                }
+                exec_process(args);
+            }
+            case OPCODE_SUBSHELL: {
+                // don't let the child flush a copy of our pending output
+                fflush(stdout);
+                pid_t pid = fork();
+                if (pid == 0) {
+                    jobs_reset();
+                    break;
+                }
+                if (pid == -1) {
+                    fprintfln(stderr, "shlol: fork: %s", strerror(errno));
+                    status = 1;
+                } else {
+                    status = wait_status(pid);
+                }
+                pc = instruction->arg.target;
+                break;
+            }
+            case OPCODE_PIPE_SPAWN: {
+                int fds[2];
+                open_stage_pipe(program->code.ptr[pc].opcode == OPCODE_PIPE_WAIT, fds);
+                if (pipeline.read_fd != -1) {
+                    BUF_PUSH(&setup.dups, ((SpawnDup){pipeline.read_fd, STDIN_FILENO}));
+                }
+                if (fds[1] != -1) {
+                    BUF_PUSH(&setup.dups, ((SpawnDup){fds[1], STDOUT_FILENO}));
+                }
+                // redirections take precedence over the pipes
+                WordList args = instruction_words(program, instruction, &expansion);
+                pid_t pid = -1;
+                if (push_redirections(program, instruction, &expansion, &setup)) {
+                    hand_down_substitutions(processes, &setup);
+                    pid = spawn_process(args, setup.dups);
+                }
+                spawn_setup_reset(&setup);
+                finish_stage(&pipeline, pid, fds);
+                break;
+            }
+            case OPCODE_PIPE_FORK: {
+                int fds[2];
+                uint32_t next = instruction->arg.target;
+                open_stage_pipe(program->code.ptr[next].opcode == OPCODE_PIPE_WAIT, fds);
+                fflush(stdout);
+                pid_t pid = fork();
+                if (pid == 0) {
+                    if (pipeline.read_fd != -1) {
+                        dup2(pipeline.read_fd, STDIN_FILENO);
+                        close(pipeline.read_fd);
+                    }
+                    if (fds[1] != -1) {
+                        dup2(fds[1], STDOUT_FILENO);
+                        close(fds[1]);
+                        close(fds[0]);
+                    }
+                    // the stage starts out with no pipeline of its own
+                    pipeline.pids.len = 0;
+                    pipeline.read_fd = -1;
+                    processes->pids.len = 0;
+                    jobs_reset();
+                    break;
+                }
+                if (pid == -1) {
+                    fprintfln(stderr, "shlol: fork: %s", strerror(errno));
+                }
+                finish_stage(&pipeline, pid, fds);
+                pc = next;
+                break;
+            }
+            case OPCODE_PIPE_WAIT: {
+                int* statuses = malloc(pipeline.pids.len * sizeof(int));
+                BUF_ASSERT(statuses != NULL);
+                wait_processes(pipeline.pids.ptr, statuses, pipeline.pids.len);
+                status = statuses[pipeline.pids.len - 1];
+                status = instruction->negated ? !status : status;
+                free(statuses);
+                pipeline.pids.len = 0;
+                // the stages' substitutions ran alongside them
+                reap_substitutions(processes);
+                break;
+            }
+            case OPCODE_BG_SPAWN: {
+                WordList args = instruction_words(program, instruction, &expansion);
+                pid_t pid = -1;
+                if (push_redirections(program, instruction, &expansion, &setup)) {
+                    pid = spawn_process(args, setup.dups);
+                }
+                spawn_setup_reset(&setup);
+                if (pid != -1) {
+                    jobs_add(pid);
+                }
+                status = 0;
+                break;
+            }
+            case OPCODE_BG_FORK: {
+                fflush(stdout);
+                pid_t pid = fork();
+                if (pid == 0) {
+                    jobs_reset();
+                    break;
+                }
+                if (pid == -1) {
+                    fprintfln(stderr, "shlol: fork: %s", strerror(errno));
+                } else {
+                    jobs_add(pid);
+                }
+                status = 0;
+                pc = instruction->arg.target;
+                break;
+            }
+            case OPCODE_EXIT:
+                exit(status);
+            case OPCODE_JUMP_IF_FAIL:
+                if (status != 0) {
+                    pc = instruction->arg.target;
+                }
+                break;
+            case OPCODE_JUMP_IF_OK:
+                if (status == 0) {
+                    pc = instruction->arg.target;
+                }
+                break;
+            case OPCODE_HALT:
+                BUF_FREE(pipeline.pids);
+                BUF_FREE(setup.dups);
+                BUF_FREE(setup.owned);
+                arena_free(&expansion.scratch);
+                BUF_FREE(processes->fds);
+                BUF_FREE(processes->pids);
+                BUF_FREE(saved);
+                return status;
+            default:
+                abort();
+        }
     }
-
-    int status;
-    waitpid(pid, &status, 0);
-    return WEXITSTATUS(status);
 }
@@ -1,8 +1,16 @@
 #ifndef EXECUTOR_H_
 #define EXECUTOR_H_
 
-#include "ast.h"
+#include <stddef.h>
 
-int execute_tree(SyntaxTree tree);
+#include "compiler.h"
+
+// Capacity requested for pipes between pipeline stages, or 0 to keep the
+// kernel's default.
+extern size_t pipe_capacity;
+
+// Runs a compiled program and returns its status. Programs compiled with
+// `tail` exit the process instead of returning.
+int execute_program(const Program* program);
 
 #endif  // EXECUTOR_H_
@@ -0,0 +1,17 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <stdint.h>
+#include <str/str.h>
+
+// FNV-1a, for the short names that key the shell's hash tables.
+static inline uint64_t hash_name(str name) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < str_len(name); i++) {
+        hash ^= (unsigned char)name.ptr[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+#endif  // HASH_H_
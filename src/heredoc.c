@@ -0,0 +1,90 @@
+#include "heredoc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <println/println.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Writes all of parts to fd, which must not be a pipe that can fill up.
+static bool write_parts(int fd, struct iovec* parts, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, parts, count);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        while (count > 0 && (size_t)written >= parts->iov_len) {
+            written -= (ssize_t)parts->iov_len;
+            parts++;
+            count--;
+        }
+        if (count > 0) {
+            parts->iov_base = (char*)parts->iov_base + written;
+            parts->iov_len -= (size_t)written;
+        }
+    }
+    return true;
+}
+
+// Returns the read end of a pipe holding the whole body, or -1 if it doesn't
+// fit in the pipe's buffer.
+static int open_pipe(const struct iovec* parts, int count, size_t len) {
+    // write_parts advances its parts, and the memfd may still need them
+    struct iovec remaining[2];
+    memcpy(remaining, parts, (size_t)count * sizeof(struct iovec));
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        return -1;
+    }
+    int capacity = fcntl(fds[1], F_GETPIPE_SZ);
+    // an empty pipe takes up to its capacity without blocking
+    bool fits = capacity > 0 && len <= (size_t)capacity;
+    if (fits && !write_parts(fds[1], remaining, count)) {
+        fits = false;
+    }
+    close(fds[1]);
+    if (!fits) {
+        close(fds[0]);
+        return -1;
+    }
+    return fds[0];
+}
+
+static int open_memfd(struct iovec* parts, int count) {
+    int fd = memfd_create("shlol-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        return -1;
+    }
+    if (!write_parts(fd, parts, count) || lseek(fd, 0, SEEK_SET) == -1) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    // readers get a snapshot that nothing can change
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    return fd;
+}
+
+int heredoc_open(str body, bool newline) {
+    struct iovec parts[2] = {
+        {.iov_base = (void*)str_ptr(body), .iov_len = str_len(body)},
+        {.iov_base = "\n", .iov_len = 1},
+    };
+    int count = newline ? 2 : 1;
+    size_t len = str_len(body) + (newline ? 1 : 0);
+
+    int fd = open_pipe(parts, count, len);
+    if (fd == -1) {
+        fd = open_memfd(parts, count);
+    }
+    if (fd == -1) {
+        fprintfln(stderr, "shlol: heredoc: %s", strerror(errno));
+    }
+    return fd;
+}
@@ -0,0 +1,14 @@
+#ifndef HEREDOC_H_
+#define HEREDOC_H_
+
+#include <stdbool.h>
+#include <str/str.h>
+
+// Returns a close-on-exec descriptor that reads back `body`, followed by a
+// newline if `newline` is set. A body that fits in a pipe's buffer is written
+// to one; a larger one goes to a sealed memfd, which readers can also seek in
+// or map. Nothing touches the filesystem. Returns -1 (after reporting the
+// error) on failure.
+int heredoc_open(str body, bool newline);
+
+#endif  // HEREDOC_H_
@@ -0,0 +1,365 @@
+#include "jobs.h"
+
+#include <buf/buf.h>
+#include <inttypes.h>
+#include <println/println.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "spawn.h"
+
+#define NO_JOB UINT32_MAX
+
+typedef struct {
+    pid_t pid;
+    // registered with the epoll instance; -1 if pidfds aren't available
+    int pidfd;
+    uint32_t id;
+    bool done;
+    int status;
+    // neighbours in job number order, or the next free slot
+    uint32_t prev;
+    uint32_t next;
+    // neighbours among finished jobs, in the order they finished
+    uint32_t done_prev;
+    uint32_t done_next;
+} Job;
+
+typedef BUF(Job) JobBuf;
+
+// Jobs live in a slab and are found by pid through an open-addressing index,
+// so adding, reaping and removing one is O(1) however many there are. Exits
+// are discovered through an epoll instance watching every job's pidfd, which
+// reports exactly the jobs that finished instead of requiring a scan.
+static struct {
+    JobBuf slab;
+    uint32_t free_head;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t done_head;
+    uint32_t done_tail;
+    uint32_t count;
+    uint32_t next_id;
+    // slab index plus one; zero marks an empty slot
+    uint32_t* index;
+    uint32_t index_cap;
+    int epoll_fd;
+    // jobs without a pidfd, which have to be polled one by one
+    uint32_t unwatched;
+} table = {
+    .slab = BUF_NEW,
+    .free_head = NO_JOB,
+    .head = NO_JOB,
+    .tail = NO_JOB,
+    .done_head = NO_JOB,
+    .done_tail = NO_JOB,
+    .next_id = 1,
+    .epoll_fd = -1,
+};
+
+static uint32_t hash_pid(pid_t pid, uint32_t cap) {
+    return ((uint32_t)pid * 2654435761U) & (cap - 1);
+}
+
+static void index_insert(uint32_t job) {
+    uint32_t slot = hash_pid(table.slab.ptr[job].pid, table.index_cap);
+    while (table.index[slot] != 0) {
+        slot = (slot + 1) & (table.index_cap - 1);
+    }
+    table.index[slot] = job + 1;
+}
+
+static void index_grow(void) {
+    uint32_t* old = table.index;
+    uint32_t old_cap = table.index_cap;
+    table.index_cap = old_cap ? old_cap * 2 : 64;
+    table.index = calloc(table.index_cap, sizeof(uint32_t));
+    BUF_ASSERT(table.index != NULL);
+    for (uint32_t i = 0; i < old_cap; i++) {
+        if (old[i] != 0) {
+            index_insert(old[i] - 1);
+        }
+    }
+    free(old);
+}
+
+static uint32_t index_find(pid_t pid) {
+    if (table.index_cap == 0) {
+        return NO_JOB;
+    }
+    uint32_t slot = hash_pid(pid, table.index_cap);
+    while (table.index[slot] != 0) {
+        uint32_t job = table.index[slot] - 1;
+        if (table.slab.ptr[job].pid == pid) {
+            return job;
+        }
+        slot = (slot + 1) & (table.index_cap - 1);
+    }
+    return NO_JOB;
+}
+
+// Backward-shift deletion, so lookups never have to skip tombstones.
+static void index_remove(pid_t pid) {
+    uint32_t mask = table.index_cap - 1;
+    uint32_t slot = hash_pid(pid, table.index_cap);
+    while (table.slab.ptr[table.index[slot] - 1].pid != pid) {
+        slot = (slot + 1) & mask;
+    }
+    uint32_t hole = slot;
+    while (true) {
+        slot = (slot + 1) & mask;
+        if (table.index[slot] == 0) {
+            break;
+        }
+        uint32_t home = hash_pid(table.slab.ptr[table.index[slot] - 1].pid, table.index_cap);
+        // move the entry back if the hole lies between its home and its slot
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            table.index[hole] = table.index[slot];
+            hole = slot;
+        }
+    }
+    table.index[hole] = 0;
+}
+
+uint32_t jobs_add(pid_t pid) {
+    if (table.epoll_fd == -1) {
+        table.epoll_fd = fd_move_high(epoll_create1(EPOLL_CLOEXEC));
+    }
+    if ((table.count + 1) * 2 > table.index_cap) {
+        index_grow();
+    }
+
+    uint32_t job = table.free_head;
+    if (job == NO_JOB) {
+        job = (uint32_t)table.slab.len;
+        BUF_PUSH(&table.slab, (Job){0});
+    } else {
+        table.free_head = table.slab.ptr[job].next;
+    }
+    if (table.count == 0) {
+        table.next_id = 1;
+    }
+
+    Job* entry = &table.slab.ptr[job];
+    *entry = (Job){
+        .pid = pid,
+        .pidfd = fd_move_high(process_pidfd(pid)),
+        .id = table.next_id++,
+        .prev = table.tail,
+        .next = NO_JOB,
+    };
+    if (entry->pidfd != -1 && table.epoll_fd != -1) {
+        struct epoll_event event = {.events = EPOLLIN, .data.u32 = job};
+        epoll_ctl(table.epoll_fd, EPOLL_CTL_ADD, entry->pidfd, &event);
+    } else {
+        if (entry->pidfd != -1) {
+            close(entry->pidfd);
+            entry->pidfd = -1;
+        }
+        table.unwatched++;
+    }
+
+    if (table.tail == NO_JOB) {
+        table.head = job;
+    } else {
+        table.slab.ptr[table.tail].next = job;
+    }
+    table.tail = job;
+    table.count++;
+    index_insert(job);
+    return entry->id;
+}
+
+static void remove_job(uint32_t job) {
+    Job* entry = &table.slab.ptr[job];
+    index_remove(entry->pid);
+    if (entry->done) {
+        if (entry->done_prev == NO_JOB) {
+            table.done_head = entry->done_next;
+        } else {
+            table.slab.ptr[entry->done_prev].done_next = entry->done_next;
+        }
+        if (entry->done_next == NO_JOB) {
+            table.done_tail = entry->done_prev;
+        } else {
+            table.slab.ptr[entry->done_next].done_prev = entry->done_prev;
+        }
+    }
+    if (entry->prev == NO_JOB) {
+        table.head = entry->next;
+    } else {
+        table.slab.ptr[entry->prev].next = entry->next;
+    }
+    if (entry->next == NO_JOB) {
+        table.tail = entry->prev;
+    } else {
+        table.slab.ptr[entry->next].prev = entry->prev;
+    }
+    entry->next = table.free_head;
+    table.free_head = job;
+    table.count--;
+}
+
+static void mark_done(uint32_t job, const siginfo_t* info) {
+    Job* entry = &table.slab.ptr[job];
+    entry->done = true;
+    entry->status = process_status(info);
+    entry->done_prev = table.done_tail;
+    entry->done_next = NO_JOB;
+    if (table.done_tail == NO_JOB) {
+        table.done_head = job;
+    } else {
+        table.slab.ptr[table.done_tail].done_next = job;
+    }
+    table.done_tail = job;
+    if (entry->pidfd != -1) {
+        // a forked child may still hold a copy of the pidfd, which would keep
+        // it in the epoll set after closing it here
+        epoll_ctl(table.epoll_fd, EPOLL_CTL_DEL, entry->pidfd, NULL);
+        close(entry->pidfd);
+        entry->pidfd = -1;
+    } else {
+        table.unwatched--;
+    }
+}
+
+// Reaps jobs that have exited, waiting up to `timeout` milliseconds (-1 for no
+// limit) for the first one if none have.
+static void reap(int timeout) {
+    if (table.unwatched > 0) {
+        for (uint32_t job = table.head; job != NO_JOB; job = table.slab.ptr[job].next) {
+            Job* entry = &table.slab.ptr[job];
+            if (entry->done || entry->pidfd != -1) {
+                continue;
+            }
+            siginfo_t info = {0};
+            if (waitid(P_PID, (id_t)entry->pid, &info, WEXITED | WNOHANG) == 0 &&
+                info.si_pid != 0) {
+                mark_done(job, &info);
+                // something finished, so don't block below
+                timeout = 0;
+            }
+        }
+        if (timeout == -1) {
+            // unwatched jobs can't wake the epoll wait, so check back on them
+            timeout = 10;
+        }
+    }
+    if (table.epoll_fd == -1) {
+        return;
+    }
+
+    struct epoll_event events[64];
+    int ready = epoll_wait(table.epoll_fd, events, 64, timeout);
+    for (int i = 0; i < ready; i++) {
+        uint32_t job = events[i].data.u32;
+        Job* entry = &table.slab.ptr[job];
+        if (entry->done || entry->pidfd == -1) {
+            // finished (and maybe removed) since the event was queued
+            continue;
+        }
+        siginfo_t info = {0};
+        if (waitid(WAIT_P_PIDFD, (id_t)entry->pidfd, &info, WEXITED | WNOHANG) == 0 &&
+            info.si_pid != 0) {
+            mark_done(job, &info);
+        }
+    }
+}
+
+void jobs_poll(void) {
+    if (table.count > 0) {
+        reap(0);
+    }
+}
+
+void jobs_print(bool only_done) {
+    jobs_poll();
+    uint32_t job = table.head;
+    while (job != NO_JOB) {
+        Job entry = table.slab.ptr[job];
+        if (entry.done) {
+            printfln("[%" PRIu32 "] %d Done (%d)", entry.id, (int)entry.pid, entry.status);
+            remove_job(job);
+        } else if (!only_done) {
+            printfln("[%" PRIu32 "] %d Running", entry.id, (int)entry.pid);
+        }
+        job = entry.next;
+    }
+}
+
+static int wait_job(uint32_t job) {
+    while (!table.slab.ptr[job].done) {
+        reap(-1);
+    }
+    int status = table.slab.ptr[job].status;
+    remove_job(job);
+    return status;
+}
+
+bool jobs_wait_pid(pid_t pid, int* status) {
+    uint32_t job = index_find(pid);
+    if (job == NO_JOB) {
+        return false;
+    }
+    *status = wait_job(job);
+    return true;
+}
+
+bool jobs_wait_id(uint32_t id, int* status) {
+    for (uint32_t job = table.head; job != NO_JOB; job = table.slab.ptr[job].next) {
+        if (table.slab.ptr[job].id == id) {
+            *status = wait_job(job);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool jobs_wait_any(int* status) {
+    if (table.count == 0) {
+        return false;
+    }
+    jobs_poll();
+    while (table.done_head == NO_JOB) {
+        reap(-1);
+    }
+    *status = wait_job(table.done_head);
+    return true;
+}
+
+int jobs_wait_all(void) {
+    int status = 0;
+    while (table.head != NO_JOB) {
+        status = wait_job(table.head);
+    }
+    return status;
+}
+
+void jobs_reset(void) {
+    // copies held open here would keep the parent's finished jobs in its
+    // epoll set
+    for (uint32_t job = table.head; job != NO_JOB; job = table.slab.ptr[job].next) {
+        if (table.slab.ptr[job].pidfd != -1) {
+            close(table.slab.ptr[job].pidfd);
+        }
+    }
+    if (table.epoll_fd != -1) {
+        close(table.epoll_fd);
+    }
+    free(table.index);
+    BUF_FREE(table.slab);
+    table.slab = (JobBuf)BUF_NEW;
+    table.free_head = NO_JOB;
+    table.head = NO_JOB;
+    table.tail = NO_JOB;
+    table.done_head = NO_JOB;
+    table.done_tail = NO_JOB;
+    table.count = 0;
+    table.next_id = 1;
+    table.index = NULL;
+    table.index_cap = 0;
+    table.epoll_fd = -1;
+    table.unwatched = 0;
+}
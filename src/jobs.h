@@ -0,0 +1,32 @@
+#ifndef JOBS_H_
+#define JOBS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Registers a background process and returns its job number.
+uint32_t jobs_add(pid_t pid);
+
+// Reaps every job that has exited since the last call, without blocking.
+// Costs one system call plus constant work per exited job.
+void jobs_poll(void);
+
+// Prints jobs in the format used by the `jobs` builtin. Finished jobs are
+// printed once and then forgotten; with `only_done`, running ones are skipped.
+void jobs_print(bool only_done);
+
+// Waits for the job with the given pid. Returns false if there is no such job.
+bool jobs_wait_pid(pid_t pid, int* status);
+// Same, for a job number.
+bool jobs_wait_id(uint32_t id, int* status);
+// Waits for the next job to finish, or takes one that already has. Returns
+// false if there are no jobs.
+bool jobs_wait_any(int* status);
+// Waits for every job and returns the status of the last one to be collected.
+int jobs_wait_all(void);
+
+// Forgets all jobs. Forked children call this, since the jobs aren't theirs.
+void jobs_reset(void);
+
+#endif  // JOBS_H_
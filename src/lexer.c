@@ -1,7 +1,160 @@
 #include "lexer.h"
 
-#include <ctype.h>
-#include <linenoise.h>
+#include <hedley/hedley.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+typedef enum {
+    CHAR_CLASS_WORD,
+    CHAR_CLASS_SPACE,
+    CHAR_CLASS_OPERATOR,
+    // NUL ends the input, as it always has
+    CHAR_CLASS_END,
+} CharClass;
+
+// Operators that share a first character map to the same entry, which is fine.
+HEDLEY_DIAGNOSTIC_PUSH
+#if defined(__GNUC__)
+#pragma GCC diagnostic ignored "-Woverride-init"
+#endif
+static const uint8_t CHAR_CLASSES[256] = {
+#define X(x)
+#define OP(x, c) [(unsigned char)(c)] = CHAR_CLASS_OPERATOR,
+#include "token_type.inc"
+#undef OP
+#undef X
+    [' '] = CHAR_CLASS_SPACE,
+    ['\t'] = CHAR_CLASS_SPACE,
+    ['\v'] = CHAR_CLASS_SPACE,
+    ['\f'] = CHAR_CLASS_SPACE,
+    ['\r'] = CHAR_CLASS_SPACE,
+    ['\0'] = CHAR_CLASS_END,
+};
+HEDLEY_DIAGNOSTIC_POP
+
+static const char OPERATOR_CHARS[] = {
+#define X(x)
+#define OP(x, c) c,
+#include "token_type.inc"
+#undef OP
+#undef X
+};
+
+static CharClass char_class(char c) {
+    return (CharClass)CHAR_CLASSES[(unsigned char)c];
+}
+
+#if defined(__SSE2__)
+// Bit i is set if p[i] is not a word byte. Matches CHAR_CLASSES exactly.
+static uint32_t word_end_mask_16(const char* p) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)p);
+    __m128i stop = _mm_or_si128(
+        _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+        _mm_cmpeq_epi8(bytes, _mm_setzero_si128())
+    );
+    // '\t' through '\r' are contiguous
+    __m128i offset = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+    __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(4)), offset);
+    stop = _mm_or_si128(stop, in_range);
+    for (size_t i = 0; i < sizeof(OPERATOR_CHARS); i++) {
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(OPERATOR_CHARS[i])));
+    }
+    return (uint32_t)_mm_movemask_epi8(stop);
+}
+#endif
+
+#if defined(__AVX2__)
+static uint32_t word_end_mask_32(const char* p) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i*)p);
+    __m256i stop = _mm256_or_si256(
+        _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')),
+        _mm256_cmpeq_epi8(bytes, _mm256_setzero_si256())
+    );
+    __m256i offset = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t'));
+    __m256i in_range = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(4)), offset);
+    stop = _mm256_or_si256(stop, in_range);
+    for (size_t i = 0; i < sizeof(OPERATOR_CHARS); i++) {
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(OPERATOR_CHARS[i])));
+    }
+    return (uint32_t)_mm256_movemask_epi8(stop);
+}
+#endif
+
+// Returns the end of the run of word bytes starting at p, skipping 32 or 16
+// bytes at a time where the target supports it.
+static const char* scan_word(const char* p, const char* end) {
+#if defined(__AVX2__)
+    while (end - p >= 32) {
+        uint32_t mask = word_end_mask_32(p);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    while (end - p >= 16) {
+        uint32_t mask = word_end_mask_16(p);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && char_class(*p) == CHAR_CLASS_WORD) {
+        p++;
+    }
+    return p;
+}
+
+static bool starts_process_substitution(const char* p, const char* end) {
+    return end - p >= 2 && (p[0] == '<' || p[0] == '>') && p[1] == '(';
+}
+
+// A word of digits right before `<` or `>` names the descriptor to redirect.
+static bool is_io_number(const char* p, const char* word_end, const char* end) {
+    if (word_end == end || (*word_end != '<' && *word_end != '>') ||
+        starts_process_substitution(word_end, end)) {
+        return false;
+    }
+    for (; p < word_end; p++) {
+        if (*p < '0' || *p > '9') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Lexes the word at p. Returns BAD, and points token_start at the culprit, if
+// a substitution in it is not terminated.
+static TokenType lex_word(Lexer* lexer, const char* p, size_t* token_start) {
+    const char* start = str_ptr(lexer->source);
+    const char* end = str_end(lexer->source);
+    const char* word_end = p;
+    if (starts_process_substitution(p, end)) {
+        word_end = skip_substitution(p + 1, end);
+        if (word_end == NULL) {
+            return TOKEN_TYPE_BAD;
+        }
+    }
+    word_end = scan_word(word_end, end);
+    // a `$(` substitution is part of the word, operators and all
+    while (word_end < end && *word_end == '(' && word_end > p && word_end[-1] == '$') {
+        const char* substitution_end = skip_substitution(word_end, end);
+        if (substitution_end == NULL) {
+            *token_start = (size_t)(word_end - 1 - start);
+            lexer->position = *token_start;
+            return TOKEN_TYPE_BAD;
+        }
+        word_end = scan_word(substitution_end, end);
+    }
+    lexer->position = (size_t)(word_end - start);
+    return is_io_number(p, word_end, end) ? TOKEN_TYPE_IO_NUMBER : TOKEN_TYPE_WORD;
+}
 
 static char peek(const Lexer* lexer, size_t n) {
     if (lexer->position + n >= str_len(lexer->source)) {
@@ -10,77 +163,188 @@ static char peek(const Lexer* lexer, size_t n) {
     return lexer->source.ptr[lexer->position + n];
 }
 
-static char current(const Lexer* lexer) {
-    return peek(lexer, 0);
+const char* skip_substitution(const char* p, const char* end) {
+    size_t depth = 0;
+    for (; p < end; p++) {
+        if (*p == '(') {
+            depth++;
+        } else if (*p == ')' && --depth == 0) {
+            return p + 1;
+        }
+    }
+    return NULL;
 }
 
-static bool is_special(char c) {
-    return isspace(c) || c == ';' || c == '(' || c == ')' || c == '&' || c == '|';
+bool word_has_substitution(str word) {
+    const char* p = str_ptr(word);
+    const char* end = str_end(word);
+    if (starts_process_substitution(p, end)) {
+        return true;
+    }
+    while ((p = memchr(p, '$', (size_t)(end - p))) != NULL) {
+        if (++p < end && *p == '(') {
+            return true;
+        }
+    }
+    return false;
 }
 
-Lexer lexer_new(str source) {
-    return (Lexer){.source = source, .position = 0};
+Lexer lexer_new(str source, Arena* arena) {
+    return (Lexer){
+        .source = source,
+        .position = 0,
+        .arena = arena,
+        .previous = TOKEN_TYPE_BAD,
+        .heredocs = {.delimiters = BUF_NEW, .bodies = BUF_NEW, .body_start = 0, .cursor = 0},
+    };
 }
 
-TokenBuf lex(Lexer* lexer) {
-    TokenBuf tokens = BUF_NEW;
+// Reads the bodies of the pending heredocs, the first of which starts after
+// the line break at `newline`. Returns false if the source ends first; the
+// lines checked so far are not checked again once it has grown.
+static bool read_heredocs(Lexer* lexer, size_t newline) {
+    HeredocQueue* queue = &lexer->heredocs;
+    const char* source = str_ptr(lexer->source);
+    size_t len = str_len(lexer->source);
+    if (queue->cursor == 0) {
+        queue->body_start = newline + 1;
+        queue->cursor = newline + 1;
+    }
+    while (lexer_heredoc_pending(lexer)) {
+        str delimiter = token_str(queue->delimiters.ptr[queue->bodies.len], lexer->source);
+        size_t line = queue->cursor;
+        const char* line_break = memchr(source + line, '\n', len - line);
+        size_t line_end = line_break != NULL ? (size_t)(line_break - source) : len;
+        bool last = queue->bodies.len + 1 == queue->delimiters.len;
+        // the delimiter ends the input only if no other body has to follow it
+        if (str_eq(str_substr(lexer->source, line, line_end - line), delimiter) &&
+            (line_break != NULL || last)) {
+            Token body = {
+                .type = TOKEN_TYPE_WORD,
+                .start = (uint32_t)queue->body_start,
+                .len = (uint32_t)(line - queue->body_start),
+            };
+            ARENA_BUF_PUSH(lexer->arena, &queue->bodies, body);
+            queue->cursor = line_break != NULL ? line_end + 1 : len;
+            queue->body_start = queue->cursor;
+            continue;
+        }
+        if (line_break == NULL) {
+            return false;
+        }
+        queue->cursor = line_end + 1;
+    }
+    lexer->position = queue->cursor;
+    queue->cursor = 0;
+    return true;
+}
 
-    while (true) {
-        while (isspace(current(lexer))) {
+Token lex_next(Lexer* lexer) {
+    const char* start = str_ptr(lexer->source);
+    const char* end = str_end(lexer->source);
+    const char* p = start + lexer->position;
+    while (p < end && char_class(*p) == CHAR_CLASS_SPACE) {
+        p++;
+    }
+    lexer->position = (size_t)(p - start);
+    size_t token_start = lexer->position;
+    TokenType type = TOKEN_TYPE_BAD;
+    switch (p < end ? *p : '\0') {
+        case '\0':
+            type = TOKEN_TYPE_EOF;
+            break;
+        case ';':
+            type = TOKEN_TYPE_SEMI;
             lexer->position++;
-        }
-        size_t token_start = lexer->position;
-        TokenType type = TOKEN_TYPE_BAD;
-        switch (current(lexer)) {
-            case '\0':
+            break;
+        case '\n':
+            if (lexer_heredoc_pending(lexer) && !read_heredocs(lexer, lexer->position)) {
                 type = TOKEN_TYPE_EOF;
                 break;
-            case ';':
-                type = TOKEN_TYPE_SEMI;
+            }
+            type = TOKEN_TYPE_NEWLINE;
+            if (lexer->position == token_start) {
                 lexer->position++;
-                break;
-            case '(':
-                type = TOKEN_TYPE_LPAREN;
+            }
+            break;
+        case '(':
+            type = TOKEN_TYPE_LPAREN;
+            lexer->position++;
+            break;
+        case ')':
+            type = TOKEN_TYPE_RPAREN;
+            lexer->position++;
+            break;
+        case '&':
+            if (peek(lexer, 1) == '&') {
+                type = TOKEN_TYPE_AMP_AMP;
+                lexer->position += 2;
+            } else {
+                type = TOKEN_TYPE_AMP;
                 lexer->position++;
-                break;
-            case ')':
-                type = TOKEN_TYPE_RPAREN;
+            }
+            break;
+        case '|':
+            if (peek(lexer, 1) == '|') {
+                type = TOKEN_TYPE_PIPE_PIPE;
+                lexer->position += 2;
+            } else {
+                type = TOKEN_TYPE_PIPE;
                 lexer->position++;
-                break;
-            case '&':
-                if (peek(lexer, 1) == '&') {
-                    type = TOKEN_TYPE_AMP_AMP;
-                    lexer->position += 2;
-                }
-                break;
-            case '|':
-                if (peek(lexer, 1) == '|') {
-                    type = TOKEN_TYPE_PIPE_PIPE;
-                    lexer->position += 2;
-                }
-                break;
-            default:
-                while (!is_special(current(lexer)) && current(lexer) != '\0') {
-                    lexer->position++;
-                }
-                type = TOKEN_TYPE_WORD;
-                break;
-        }
-
-        if (type == TOKEN_TYPE_BAD) {
+            }
             break;
-        }
-
-        Token token = {
-            .type = type,
-            .position = token_start,
-            .text = str_substr_bounds(lexer->source, token_start, lexer->position),
-        };
-        BUF_PUSH(&tokens, token);
-        if (token.type == TOKEN_TYPE_EOF) {
+        case '<':
+            if (peek(lexer, 1) == '(') {
+                type = lex_word(lexer, p, &token_start);
+            } else if (peek(lexer, 1) == '<' && peek(lexer, 2) == '<') {
+                type = TOKEN_TYPE_TLESS;
+                lexer->position += 3;
+            } else if (peek(lexer, 1) == '<') {
+                type = TOKEN_TYPE_DLESS;
+                lexer->position += 2;
+            } else if (peek(lexer, 1) == '&') {
+                type = TOKEN_TYPE_LESS_AMP;
+                lexer->position += 2;
+            } else {
+                type = TOKEN_TYPE_LESS;
+                lexer->position++;
+            }
+            break;
+        case '>':
+            if (peek(lexer, 1) == '(') {
+                type = lex_word(lexer, p, &token_start);
+            } else if (peek(lexer, 1) == '>') {
+                type = TOKEN_TYPE_DGREAT;
+                lexer->position += 2;
+            } else if (peek(lexer, 1) == '&') {
+                type = TOKEN_TYPE_GREAT_AMP;
+                lexer->position += 2;
+            } else {
+                type = TOKEN_TYPE_GREAT;
+                lexer->position++;
+            }
+            break;
+        default:
+            type = lex_word(lexer, p, &token_start);
             break;
-        }
     }
 
-    return tokens;
+    if (type == TOKEN_TYPE_BAD) {
+        lexer->position++;
+    }
+
+    Token token = {
+        .type = type,
+        .start = (uint32_t)token_start,
+        .len = (uint32_t)(lexer->position - token_start),
+    };
+    if (type == TOKEN_TYPE_NEWLINE) {
+        // the bodies skipped over aren't part of the token
+        token.len = 1;
+    }
+    if (type == TOKEN_TYPE_WORD && lexer->previous == TOKEN_TYPE_DLESS) {
+        ARENA_BUF_PUSH(lexer->arena, &lexer->heredocs.delimiters, token);
+    }
+    lexer->previous = type;
+    return token;
 }
@@ -1,17 +1,52 @@
 #ifndef LEXER_H_
 #define LEXER_H_
 
+#include <arena/arena.h>
+#include <buf/buf.h>
+#include <stdbool.h>
 #include <str/str.h>
 
 #include "token.h"
 
+typedef BUF(Token) TokenBuf;
+
+// Here-documents whose delimiters have been lexed. Their bodies start on the
+// line after the operator and are read, then skipped, when the line ends.
+typedef struct {
+    // the delimiter words, in order
+    TokenBuf delimiters;
+    // the bodies read so far, each up to its delimiter line
+    TokenBuf bodies;
+    // once the line has ended, where the next body starts and where the line
+    // being checked for its delimiter starts
+    size_t body_start;
+    size_t cursor;
+} HeredocQueue;
+
 typedef struct {
     str source;
     size_t position;
+    // backs the heredoc queue
+    Arena* arena;
+    TokenType previous;
+    HeredocQueue heredocs;
 } Lexer;
 
-Lexer lexer_new(str source);
+Lexer lexer_new(str source, Arena* arena);
+
+static inline bool lexer_heredoc_pending(const Lexer* lexer) {
+    return lexer->heredocs.bodies.len < lexer->heredocs.delimiters.len;
+}
 
-TokenBuf lex(Lexer* lexer);
+// Lexes the next token. Once the end of input is reached, every further call
+// returns EOF. A line break is only lexed once the bodies of the heredocs
+// before it are complete; until then it is left unconsumed and EOF returned,
+// so lexing can carry on after the source grows.
+Token lex_next(Lexer* lexer);
+// Given `p` at the `(` of a `$(`, `<(` or `>(` substitution, returns the
+// position after its matching `)`, or NULL if the input ends first.
+const char* skip_substitution(const char* p, const char* end);
+// Whether word contains a command substitution or is a process substitution.
+bool word_has_substitution(str word);
 
 #endif  // LEXER_H_
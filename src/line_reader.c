@@ -0,0 +1,77 @@
+#include "line_reader.h"
+
+#include <buf/buf.h>
+#include <errno.h>
+#include <println/println.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LINE_READER_BLOCK (64 * 1024)
+
+LineReader line_reader_new(int fd) {
+    return (LineReader){.fd = fd, .buf = NULL, .cap = 0, .start = 0, .end = 0, .eof = false};
+}
+
+// Moves the unfinished line to the front of the buffer, growing it if the line
+// already fills it, and reads another block after it.
+static void fill(LineReader* reader) {
+    size_t pending = reader->end - reader->start;
+    if (reader->start > 0) {
+        memmove(reader->buf, reader->buf + reader->start, pending);
+        reader->start = 0;
+        reader->end = pending;
+    }
+    if (reader->end == reader->cap) {
+        reader->cap = reader->cap ? reader->cap * 2 : LINE_READER_BLOCK;
+        reader->buf = realloc(reader->buf, reader->cap);
+        BUF_ASSERT(reader->buf != NULL);
+    }
+
+    ssize_t n;
+    do {
+        n = read(reader->fd, reader->buf + reader->end, reader->cap - reader->end);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1) {
+        fprintfln(stderr, "shlol: read: %s", strerror(errno));
+    }
+    if (n <= 0) {
+        reader->eof = true;
+        return;
+    }
+    reader->end += (size_t)n;
+}
+
+bool line_reader_next(LineReader* reader, str* line) {
+    // bytes before this have already been searched for a newline
+    size_t scanned = reader->start;
+    while (true) {
+        char* newline = NULL;
+        if (scanned < reader->end) {
+            newline = memchr(reader->buf + scanned, '\n', reader->end - scanned);
+        }
+        if (newline != NULL) {
+            size_t len = (size_t)(newline - (reader->buf + reader->start));
+            *line = str_ref_chars(reader->buf + reader->start, len);
+            reader->start += len + 1;
+            return true;
+        }
+        if (reader->eof) {
+            if (reader->start == reader->end) {
+                return false;
+            }
+            // the last line has no newline
+            *line = str_ref_chars(reader->buf + reader->start, reader->end - reader->start);
+            reader->start = reader->end;
+            return true;
+        }
+        size_t searched = reader->end - reader->start;
+        fill(reader);
+        scanned = reader->start + searched;
+    }
+}
+
+void line_reader_free(LineReader* reader) {
+    free(reader->buf);
+    *reader = line_reader_new(reader->fd);
+}
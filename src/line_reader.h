@@ -0,0 +1,26 @@
+#ifndef LINE_READER_H_
+#define LINE_READER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <str/str.h>
+
+// Reads lines from a file descriptor in large blocks. Lines are handed out as
+// references into the reader's buffer, so nothing is copied per line.
+typedef struct {
+    int fd;
+    char* buf;
+    size_t cap;
+    // unread data is buf[start, end)
+    size_t start;
+    size_t end;
+    bool eof;
+} LineReader;
+
+LineReader line_reader_new(int fd);
+// Stores the next line, without its newline, in `line`. The line stays valid
+// until the next call. Returns false at the end of input.
+bool line_reader_next(LineReader* reader, str* line);
+void line_reader_free(LineReader* reader);
+
+#endif  // LINE_READER_H_
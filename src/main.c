@@ -1,86 +1,274 @@
 #include <stddef.h>
 // order dependent
+#include <arena/arena.h>
 #include <buf/buf.h>
 #include <errno.h>
 #include <hedley/hedley.h>
+#include <limits.h>
 #include <linenoise.h>
 #include <println/println.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdnoreturn.h>
+#include <string.h>
 #include <str/str.h>
+#include <str/strtox.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "executor.h"
+#include "jobs.h"
+#include "lexer.h"
+#include "line_reader.h"
+#include "parse_cache.h"
 #include "parser.h"
+#include "script.h"
+#include "spawn.h"
 
 #define scope(begin, end) for (bool i = (begin, false); !i; (i = true, end))
 #define defer(expr) for (bool i = false; !i; (i = true, expr))
 
-typedef BUF(str) LineBuf;
+// Holds the command being entered. Continuation lines are appended in place,
+// so a long multi-line command is copied a constant number of times overall.
+typedef BUF(char) InputBuf;
 
-int main(void) {
-    linenoiseHistoryLoad("shlol.history");
+static void input_append(InputBuf* input, str text) {
+    if (input->len + str_len(text) > input->cap) {
+        size_t cap = input->cap ? input->cap : 128;
+        while (cap < input->len + str_len(text)) {
+            cap *= 2;
+        }
+        input->ptr = realloc(input->ptr, cap);
+        BUF_ASSERT(input->ptr != NULL);
+        input->cap = cap;
+    }
+    memcpy(input->ptr + input->len, str_ptr(text), str_len(text));
+    input->len += str_len(text);
+}
+
+// Without a terminal there is no line editing, prompt or history, and stdin
+// is read in blocks instead.
+static bool interactive;
+static LineReader stdin_reader;
+
+// Reads the next line, without its newline. The line stays valid until the
+// next call. Returns false on EOF.
+static bool read_line(str* line, const char* prompt) {
+    if (!interactive) {
+        return line_reader_next(&stdin_reader, line);
+    }
+
+    static char* raw_line = NULL;
+    free(raw_line);
+    raw_line = linenoise(prompt);
+    if (raw_line == NULL) {
+        return false;
+    }
+    linenoiseHistoryAdd(raw_line);
+    *line = str_ref(raw_line);
+    return true;
+}
+
+// Runs `shlol -c command`. The command is compiled as the tail of the
+// process, so its last external command replaces the shell.
+static int run_command_string(const char* command) {
+    if (str_is_empty(str_trim(str_ref(command), str_lit(" \t\n\v\f\r")))) {
+        return 0;
+    }
+    Arena arena = ARENA_NEW;
+    Parser parser = parser_new(str_ref(command), &arena);
+    ParseResult parse_result = parser_parse(&parser);
+    if (!parse_result.present) {
+        return 2;
+    }
+    if (!parse_result.value.left) {
+        fprintfln(stderr, "shlol: -c: unexpected end of input");
+        return 2;
+    }
+    Program program = compile_tree(&parse_result.value.get.left, &arena, true);
+    return execute_program(&program);
+}
 
-    bool red_prompt = false;
+// Counts the ( and ) of a command as its lines are joined. The text already
+// scanned never changes as the input grows, so each line is only lexed once.
+typedef struct {
+    Lexer lexer;
+    uint32_t depth;
+} ParenScan;
 
+// Whether source leaves a subshell open, so that the command carries on on the
+// next line. The parser can only resume after an operator, so this is checked
+// before parsing. source is what scan saw last time, with more input added.
+static bool subshell_open(ParenScan* scan, str source) {
+    scan->lexer.source = source;
+    if (scan->depth == 0 && !str_find_char(str_after(source, scan->lexer.position), '(').found) {
+        return false;
+    }
     while (true) {
-        char* raw_line = linenoise(red_prompt ? "\x1b[31m$ \x1b[0m" : "$ ");
-        if (raw_line == NULL) {
-            break;
+        size_t position = scan->lexer.position;
+        TokenType previous = scan->lexer.previous;
+        Token token = lex_next(&scan->lexer);
+        switch (token.type) {
+            case TOKEN_TYPE_LPAREN:
+                scan->depth++;
+                break;
+            case TOKEN_TYPE_RPAREN:
+                scan->depth -= scan->depth > 0;
+                break;
+            case TOKEN_TYPE_BAD:
+                // an unterminated quote, which the next line may close
+                scan->lexer.position = position;
+                scan->lexer.previous = previous;
+                return scan->depth > 0;
+            case TOKEN_TYPE_EOF:
+                return scan->depth > 0;
+            default:
+                break;
+        }
+    }
+}
+
+static str input_str(const InputBuf* input) {
+    return str_ref_chars(input->ptr, input->len);
+}
+
+int main(int argc, char** argv) {
+    str backend_name = str_ref(getenv("SHLOL_SPAWN"));
+    if (!str_is_empty(backend_name) && !spawn_backend_from_name(backend_name, &spawn_backend)) {
+        fprintfln(stderr, "SHLOL_SPAWN: unknown backend '" str_fmt "'", str_arg(backend_name));
+    }
+
+    str pipe_size = str_ref(getenv("SHLOL_PIPE_SIZE"));
+    if (!str_is_empty(pipe_size)) {
+        Str2U64Result size = str2u64(pipe_size, 10);
+        if (size.err || size.endptr != str_end(pipe_size) || size.value > INT_MAX) {
+            fprintfln(stderr, "SHLOL_PIPE_SIZE: invalid size '" str_fmt "'", str_arg(pipe_size));
+        } else {
+            pipe_capacity = (size_t)size.value;
         }
+    }
+
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc == 2) {
+            fprintfln(stderr, "shlol: -c: option requires an argument");
+            return 2;
+        }
+        return run_command_string(argv[2]);
+    }
+    if (argc > 1) {
+        // the remaining arguments are the script's, but nothing expands them yet
+        return script_run(argv[1]);
+    }
+
+    interactive = isatty(STDIN_FILENO);
+    if (interactive) {
+        linenoiseHistoryLoad("shlol.history");
+    } else {
+        stdin_reader = line_reader_new(STDIN_FILENO);
+    }
 
-        linenoiseHistoryAdd(raw_line);
-        LineBuf all_lines = BUF_NEW;
-        str line = str_acquire(raw_line);
+    int status = 0;
+    // holds the tokens and tree of the line being run; reset before each prompt
+    Arena line_arena = ARENA_NEW;
+    InputBuf input = BUF_NEW;
 
-        while (str_has_suffix(line, str_lit("\\"))) {
-            char* raw_line = linenoise("> ");
-            if (raw_line == NULL) {
+    while (true) {
+        if (interactive) {
+            jobs_print(true);
+        } else {
+            jobs_poll();
+        }
+        fflush(stdout);
+        str line;
+        if (!read_line(&line, status != 0 ? "\x1b[31m$ \x1b[0m" : "$ ")) {
+            break;
+        }
+
+        // The source is parsed straight out of the line unless it needs
+        // joining with more lines, which happens in `input`.
+        str source = line;
+        input.len = 0;
+        bool joined = false;
+        bool eof = false;
+        arena_reset(&line_arena);
+        ParenScan scan = {.lexer = lexer_new(source, &line_arena), .depth = 0};
+        while (!eof) {
+            bool escaped = str_has_suffix(source, str_lit("\\"));
+            if (!escaped && !subshell_open(&scan, source)) {
                 break;
             }
+            if (!joined) {
+                input_append(&input, source);
+                joined = true;
+            }
+            if (escaped) {
+                input.len--;
+            } else {
+                input_append(&input, str_lit("\n"));
+            }
+            eof = !read_line(&line, "> ");
+            if (!eof) {
+                input_append(&input, line);
+            }
+            source = input_str(&input);
+        }
 
-            linenoiseHistoryAdd(raw_line);
-            str line2 = str_acquire(raw_line);
-            str full_line = str_cat_ret(str_upto(line, str_len(line) - 1), line2);
-            str_free(line);
-            str_free(line2);
-            line = full_line;
+        if (str_is_empty(str_trim(source, str_lit(" \t\v\f\r")))) {
+            continue;
         }
-        BUF_PUSH(&all_lines, line);
 
-        Parser parser = parser_new(str_ref(line));
+        // piped input seldom repeats a line, so caching it would only cost a
+        // copy of every tree
+        const CachedParse* cached = interactive ? parse_cache_get(source) : NULL;
+        if (cached != NULL) {
+            status = execute_program(&cached->program);
+            parse_cache_release(cached);
+            continue;
+        }
+
+        Parser parser = parser_new(source, &line_arena);
         ParseResult parse_result = parser_parse(&parser);
-        if (!parse_result.present) {
-            red_prompt = true;
-            for (uint64_t i = 0; i < all_lines.len; i++) {
-                str_free(all_lines.ptr[i]);
+        bool continued = false;
+        while (parse_result.present && !parse_result.value.left && !eof) {
+            if (!joined) {
+                input_append(&input, source);
+                joined = true;
+            }
+            // keep the lines apart so their last and first words stay separate
+            input_append(&input, str_lit("\n"));
+            eof = !read_line(&line, "> ");
+            if (!eof) {
+                input_append(&input, line);
             }
-            BUF_FREE(all_lines);
+            continued = true;
+            source = input_str(&input);
+            parse_result = parser_resume_parse(&parser, parse_result.value.get.right, source);
+        }
+        if (!parse_result.present || !parse_result.value.left) {
+            // a syntax error, or the input ended in the middle of a command
+            status = 2;
             continue;
         }
-        while (!parse_result.value.left) {
-            char* raw_line = linenoise("> ");
-            if (raw_line == NULL) {
-                break;
-            }
 
-            linenoiseHistoryAdd(raw_line);
-            str line2 = str_acquire(raw_line);
-            BUF_PUSH(&all_lines, line2);
-
-            parse_result = parser_resume_parse(&parser, parse_result.value.get.right, line2);
-        }
         SyntaxTree tree = parse_result.value.get.left;
-        int status = execute_tree(tree);
-        red_prompt = status != 0;
-        syntax_tree_free(tree);
-        for (uint64_t i = 0; i < all_lines.len; i++) {
-            str_free(all_lines.ptr[i]);
+        if (interactive && !continued) {
+            // the input is only the whole key if the parse was not resumed
+            cached = parse_cache_put(source, &tree);
+            status = execute_program(&cached->program);
+            parse_cache_release(cached);
+        } else {
+            Program program = compile_tree(&tree, &line_arena, false);
+            status = execute_program(&program);
         }
-        BUF_FREE(all_lines);
     }
 
-    linenoiseHistorySave("shlol.history");
+    BUF_FREE(input);
+    arena_free(&line_arena);
+    if (interactive) {
+        linenoiseHistorySave("shlol.history");
+    } else {
+        line_reader_free(&stdin_reader);
+    }
+    return status;
 }
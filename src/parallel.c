@@ -0,0 +1,402 @@
+#include "parallel.h"
+
+#include <arena/arena.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <println/println.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdnoreturn.h>
+#include <str/strtox.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "builtin.h"
+#include "compiler.h"
+#include "executor.h"
+#include "jobs.h"
+#include "line_reader.h"
+#include "parser.h"
+#include "spawn.h"
+
+#define PARALLEL_MAX_FAILURES 101
+
+typedef enum {
+    // each job's output is written when it finishes
+    OUTPUT_GROUPED,
+    // like OUTPUT_GROUPED, but in input order
+    OUTPUT_ORDERED,
+    // complete lines are written as soon as they arrive
+    OUTPUT_LINES,
+} OutputMode;
+
+typedef struct {
+    size_t slots;
+    OutputMode mode;
+    bool halt;
+    // empty if each line is a shell command
+    WordList template;
+} ParallelOptions;
+
+typedef BUF(char) OutputBuf;
+
+typedef struct {
+    pid_t pid;
+    // read end of the job's stdout, or -1 once it reached EOF
+    int fd;
+    bool done;
+    int status;
+    OutputBuf output;
+} ParallelJob;
+
+typedef BUF(ParallelJob) ParallelJobBuf;
+
+// State of one run. Jobs are numbered in input order; `jobs` holds those from
+// `base` on, so ordered output only has to keep the ones it can't write yet.
+typedef struct {
+    ParallelOptions options;
+    ParallelJobBuf jobs;
+    uint64_t base;
+    // numbers of the jobs whose output is still open
+    BUF(uint64_t) running;
+    // /dev/null, the jobs' stdin: the builtin's own stdin holds the lines that
+    // are still to come, which jobs would otherwise read a block of
+    int null_fd;
+    int failures;
+    int halt_status;
+} Parallel;
+
+static bool parse_options(WordList argv, ParallelOptions* options) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    *options = (ParallelOptions){
+        .slots = cpus > 0 ? (size_t)cpus : 1,
+        .mode = OUTPUT_GROUPED,
+        .halt = false,
+        .template = BUF_REF(NULL, 0),
+    };
+    uint64_t i = 1;
+    for (; i < argv.len; i++) {
+        str arg = argv.ptr[i];
+        if (str_eq(arg, str_lit("--"))) {
+            i++;
+            break;
+        }
+        if (str_eq(arg, str_lit("-k"))) {
+            options->mode = OUTPUT_ORDERED;
+        } else if (str_eq(arg, str_lit("-l"))) {
+            options->mode = OUTPUT_LINES;
+        } else if (str_eq(arg, str_lit("-x"))) {
+            options->halt = true;
+        } else if (str_has_prefix(arg, str_lit("-j"))) {
+            str count = str_after(arg, 2);
+            if (str_is_empty(count)) {
+                if (i + 1 == argv.len) {
+                    fprintfln(stderr, "parallel: -j: missing job count");
+                    return false;
+                }
+                count = argv.ptr[++i];
+            }
+            Str2U64Result slots = str2u64(count, 10);
+            if (slots.err || slots.endptr != str_end(count) || slots.value == 0) {
+                fprintfln(stderr, "parallel: -j: invalid job count '" str_fmt "'", str_arg(count));
+                return false;
+            }
+            options->slots = (size_t)slots.value;
+        } else if (str_has_prefix(arg, str_lit("-")) && str_len(arg) > 1) {
+            fprintfln(stderr, "parallel: unknown option '" str_fmt "'", str_arg(arg));
+            return false;
+        } else {
+            break;
+        }
+    }
+    WordList template = BUF_SHIFTED(argv, i);
+    options->template = template;
+    return true;
+}
+
+// Replaces every `{}` in word with line.
+static str substitute(Arena* arena, str word, str line, bool* used) {
+    str placeholder = str_lit("{}");
+    size_t count = 0;
+    for (size_t i = 0; i + 1 < str_len(word); i++) {
+        if (str_eq(str_substr(word, i, 2), placeholder)) {
+            count++;
+            i++;
+        }
+    }
+    if (count == 0) {
+        return word;
+    }
+    *used = true;
+
+    size_t len = str_len(word) + count * str_len(line) - count * 2;
+    char* out = ARENA_NEW_ARRAY(arena, char, len);
+    size_t n = 0;
+    for (size_t i = 0; i < str_len(word); i++) {
+        if (i + 1 < str_len(word) && str_eq(str_substr(word, i, 2), placeholder)) {
+            memcpy(out + n, str_ptr(line), str_len(line));
+            n += str_len(line);
+            i++;
+        } else {
+            out[n++] = word.ptr[i];
+        }
+    }
+    return str_ref_chars(out, len);
+}
+
+// Runs a line as a shell command in a forked child, which never returns.
+static noreturn void run_line(str line) {
+    Arena arena = ARENA_NEW;
+    Parser parser = parser_new(line, &arena);
+    ParseResult parse_result = parser_parse(&parser);
+    if (!parse_result.present) {
+        exit(2);
+    }
+    if (!parse_result.value.left) {
+        fprintfln(stderr, "parallel: unexpected end of command");
+        exit(2);
+    }
+    Program program = compile_tree(&parse_result.value.get.left, &arena, true);
+    execute_program(&program);
+    abort();
+}
+
+// Starts the job for `line` with its stdout going to `out_fd`. Returns -1 if
+// it couldn't be started.
+static pid_t start_job(const ParallelOptions* options, str line, int in_fd, int out_fd) {
+    WordList argv = BUF_NEW;
+    Arena arena = ARENA_NEW;
+    BuiltinCallback* builtin = NULL;
+    if (options->template.len > 0) {
+        bool used = false;
+        for (uint64_t i = 0; i < options->template.len; i++) {
+            str word = substitute(&arena, options->template.ptr[i], line, &used);
+            ARENA_BUF_PUSH(&arena, &argv, word);
+        }
+        if (!used) {
+            ARENA_BUF_PUSH(&arena, &argv, line);
+        }
+        builtin = builtin_lookup(argv.ptr[0]);
+        if (builtin == NULL) {
+            SpawnDup dups[] = {{in_fd, STDIN_FILENO}, {out_fd, STDOUT_FILENO}};
+            pid_t pid = spawn_process(argv, (SpawnDupList)BUF_REF(dups, 2));
+            arena_free(&arena);
+            return pid;
+        }
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(in_fd, STDIN_FILENO);
+        dup2(out_fd, STDOUT_FILENO);
+        close(out_fd);
+        jobs_reset();
+        if (builtin != NULL) {
+            exit(builtin(argv));
+        }
+        run_line(line);
+    }
+    arena_free(&arena);
+    if (pid == -1) {
+        fprintfln(stderr, "parallel: fork: %s", strerror(errno));
+    }
+    return pid;
+}
+
+static ParallelJob* job_at(Parallel* parallel, uint64_t number) {
+    return &parallel->jobs.ptr[number - parallel->base];
+}
+
+static void append_output(OutputBuf* output, const char* data, size_t len) {
+    if (output->len + len > output->cap) {
+        size_t cap = output->cap ? output->cap : 4096;
+        while (cap < output->len + len) {
+            cap *= 2;
+        }
+        output->ptr = realloc(output->ptr, cap);
+        BUF_ASSERT(output->ptr != NULL);
+        output->cap = cap;
+    }
+    memcpy(output->ptr + output->len, data, len);
+    output->len += len;
+}
+
+static void write_output(str output) {
+    fwrite(str_ptr(output), 1, str_len(output), stdout);
+}
+
+static void record_status(Parallel* parallel, int status) {
+    if (status == 0) {
+        return;
+    }
+    if (parallel->failures == 0) {
+        parallel->halt_status = status;
+    }
+    parallel->failures++;
+}
+
+static void launch(Parallel* parallel, str line) {
+    uint64_t number = parallel->base + parallel->jobs.len;
+    ParallelJob job = {.pid = -1, .fd = -1, .done = false, .status = 1, .output = BUF_NEW};
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        fprintfln(stderr, "parallel: pipe: %s", strerror(errno));
+        job.done = true;
+    } else {
+        job.pid = start_job(&parallel->options, line, parallel->null_fd, fds[1]);
+        close(fds[1]);
+        if (job.pid == -1) {
+            close(fds[0]);
+            job.done = true;
+        } else {
+            job.fd = fds[0];
+            BUF_PUSH(&parallel->running, number);
+        }
+    }
+    if (job.done) {
+        record_status(parallel, job.status);
+    }
+    BUF_PUSH(&parallel->jobs, job);
+}
+
+// Writes out and drops finished jobs from the front.
+static void flush_finished(Parallel* parallel) {
+    uint64_t done = 0;
+    while (done < parallel->jobs.len && parallel->jobs.ptr[done].done) {
+        ParallelJob* job = &parallel->jobs.ptr[done];
+        if (parallel->options.mode == OUTPUT_ORDERED) {
+            write_output(str_ref_chars(job->output.ptr, job->output.len));
+        }
+        BUF_FREE(job->output);
+        done++;
+    }
+    if (done == 0) {
+        return;
+    }
+    memmove(
+        parallel->jobs.ptr,
+        parallel->jobs.ptr + done,
+        (parallel->jobs.len - done) * sizeof(ParallelJob)
+    );
+    parallel->jobs.len -= done;
+    parallel->base += done;
+}
+
+static void finish(Parallel* parallel, uint64_t number) {
+    ParallelJob* job = job_at(parallel, number);
+    close(job->fd);
+    job->fd = -1;
+    siginfo_t info;
+    if (waitid(P_PID, (id_t)job->pid, &info, WEXITED) == 0) {
+        job->status = process_status(&info);
+    }
+    job->done = true;
+
+    if (parallel->options.mode != OUTPUT_ORDERED) {
+        write_output(str_ref_chars(job->output.ptr, job->output.len));
+        job->output.len = 0;
+    }
+    record_status(parallel, job->status);
+}
+
+// Reads what is available from a job. Returns false at EOF.
+static bool read_job(Parallel* parallel, uint64_t number) {
+    ParallelJob* job = job_at(parallel, number);
+    char chunk[65536];
+    ssize_t n;
+    do {
+        n = read(job->fd, chunk, sizeof(chunk));
+    } while (n == -1 && errno == EINTR);
+    if (n <= 0) {
+        return false;
+    }
+    append_output(&job->output, chunk, (size_t)n);
+
+    if (parallel->options.mode == OUTPUT_LINES) {
+        char* end = memrchr(job->output.ptr, '\n', job->output.len);
+        if (end != NULL) {
+            size_t len = (size_t)(end - job->output.ptr) + 1;
+            write_output(str_ref_chars(job->output.ptr, len));
+            memmove(job->output.ptr, job->output.ptr + len, job->output.len - len);
+            job->output.len -= len;
+        }
+    }
+    return true;
+}
+
+// Waits until at least one running job has output or finished, and handles it.
+static void wait_for_jobs(Parallel* parallel) {
+    size_t count = parallel->running.len;
+    struct pollfd* fds = calloc(count, sizeof(struct pollfd));
+    BUF_ASSERT(fds != NULL);
+    for (size_t i = 0; i < count; i++) {
+        int fd = job_at(parallel, parallel->running.ptr[i])->fd;
+        fds[i] = (struct pollfd){.fd = fd, .events = POLLIN};
+    }
+    if (poll(fds, count, -1) == -1) {
+        free(fds);
+        return;
+    }
+
+    // walk backwards so finished jobs can be swapped out of `running`
+    for (size_t i = count; i-- > 0;) {
+        if (fds[i].revents == 0) {
+            continue;
+        }
+        uint64_t number = parallel->running.ptr[i];
+        if (!read_job(parallel, number)) {
+            finish(parallel, number);
+            parallel->running.ptr[i] = BUF_LAST(parallel->running);
+            parallel->running.len--;
+        }
+    }
+    free(fds);
+    flush_finished(parallel);
+}
+
+int parallel_command(WordList argv) {
+    Parallel parallel = {.jobs = BUF_NEW, .base = 0, .running = BUF_NEW};
+    if (!parse_options(argv, &parallel.options)) {
+        return 2;
+    }
+    parallel.null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (parallel.null_fd == -1) {
+        fprintfln(stderr, "parallel: /dev/null: %s", strerror(errno));
+        return 2;
+    }
+
+    LineReader reader = line_reader_new(STDIN_FILENO);
+    bool input_done = false;
+    while (true) {
+        bool halted = parallel.options.halt && parallel.failures > 0;
+        while (!input_done && !halted && parallel.running.len < parallel.options.slots) {
+            str line;
+            if (!line_reader_next(&reader, &line)) {
+                input_done = true;
+                break;
+            }
+            if (parallel.options.template.len == 0 &&
+                str_is_empty(str_trim(line, str_lit(" \t\v\f\r")))) {
+                continue;
+            }
+            launch(&parallel, line);
+        }
+        flush_finished(&parallel);
+        if (parallel.running.len == 0) {
+            break;
+        }
+        wait_for_jobs(&parallel);
+    }
+
+    line_reader_free(&reader);
+    close(parallel.null_fd);
+    BUF_FREE(parallel.jobs);
+    BUF_FREE(parallel.running);
+    if (parallel.options.halt) {
+        return parallel.halt_status;
+    }
+    return parallel.failures < PARALLEL_MAX_FAILURES ? parallel.failures : PARALLEL_MAX_FAILURES;
+}
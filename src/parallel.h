@@ -0,0 +1,20 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include "ast.h"
+
+// parallel [-j N] [-k | -l] [-x] [command [arg...]]
+//
+// Runs one job per line of stdin, at most N at a time (default: one per
+// CPU). With a command, a job runs it with `{}` in its arguments replaced by
+// the line, or with the line appended if no argument contains `{}`. Without
+// one, each line is run as a shell command.
+//
+// Each job's stdout is captured and written out whole when the job finishes;
+// -k writes jobs out in input order instead, and -l passes complete lines
+// through as they arrive. With -x, no new jobs start after one fails and its
+// status is returned. Otherwise every job runs, and the status is the number
+// of failed jobs, capped at 101.
+int parallel_command(WordList argv);
+
+#endif  // PARALLEL_H_
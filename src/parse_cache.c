@@ -0,0 +1,185 @@
+#include "parse_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PARSE_CACHE_CAPACITY 64
+#define PARSE_CACHE_BUCKETS 128
+
+typedef struct ParseCacheEntry ParseCacheEntry;
+
+struct ParseCacheEntry {
+    CachedParse base;
+    uint64_t hash;
+    uint32_t refs;
+    // false once evicted; the entry then lives on only for its references
+    bool cached;
+    ParseCacheEntry* bucket_next;
+    ParseCacheEntry* lru_prev;
+    ParseCacheEntry* lru_next;
+    // owns the entry itself and everything it points to
+    Arena arena;
+};
+
+static struct {
+    ParseCacheEntry* buckets[PARSE_CACHE_BUCKETS];
+    // most recently used first
+    ParseCacheEntry* lru_head;
+    ParseCacheEntry* lru_tail;
+    ParseCacheStats stats;
+} cache;
+
+static uint64_t hash_source(str source) {
+    const unsigned char* p = (const unsigned char*)str_ptr(source);
+    size_t len = str_len(source);
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ len;
+    while (len >= 8) {
+        uint64_t chunk;
+        memcpy(&chunk, p, sizeof(chunk));
+        hash = (hash ^ chunk) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+        p += 8;
+        len -= 8;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, p, len);
+    hash = (hash ^ tail) * 0xC4CEB9FE1A85EC53ULL;
+    return hash ^ (hash >> 29);
+}
+
+static void lru_unlink(ParseCacheEntry* entry) {
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache.lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache.lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void lru_push_front(ParseCacheEntry* entry) {
+    entry->lru_next = cache.lru_head;
+    if (cache.lru_head != NULL) {
+        cache.lru_head->lru_prev = entry;
+    } else {
+        cache.lru_tail = entry;
+    }
+    cache.lru_head = entry;
+}
+
+static void entry_free(ParseCacheEntry* entry) {
+    Arena arena = entry->arena;
+    arena_free(&arena);
+}
+
+static void evict(ParseCacheEntry* entry) {
+    ParseCacheEntry** link = &cache.buckets[entry->hash % PARSE_CACHE_BUCKETS];
+    while (*link != entry) {
+        link = &(*link)->bucket_next;
+    }
+    *link = entry->bucket_next;
+    lru_unlink(entry);
+    entry->cached = false;
+    cache.stats.entries--;
+    if (entry->refs == 0) {
+        entry_free(entry);
+    }
+}
+
+const CachedParse* parse_cache_get(str source) {
+    uint64_t hash = hash_source(source);
+    for (ParseCacheEntry* entry = cache.buckets[hash % PARSE_CACHE_BUCKETS]; entry != NULL;
+         entry = entry->bucket_next) {
+        if (entry->hash == hash && str_eq(entry->base.source, source)) {
+            lru_unlink(entry);
+            lru_push_front(entry);
+            entry->refs++;
+            cache.stats.hits++;
+            return &entry->base;
+        }
+    }
+    cache.stats.misses++;
+    return NULL;
+}
+
+// Words normally point into the source and are moved along with it; anything
+// else is copied.
+static str clone_word(Arena* arena, str word, str old_source, const char* new_source) {
+    if (word.ptr >= old_source.ptr && str_end(word) <= str_end(old_source)) {
+        return str_ref_chars(new_source + (word.ptr - old_source.ptr), str_len(word));
+    }
+    char* copy = ARENA_NEW_ARRAY(arena, char, str_len(word));
+    memcpy(copy, str_ptr(word), str_len(word));
+    return str_ref_chars(copy, str_len(word));
+}
+
+#define CLONE_BUF(arena, dest, src) \
+    do { \
+        (dest)->ptr = NULL; \
+        if ((src).len > 0) { \
+            size_t size = (src).len * sizeof(*(src).ptr); \
+            (dest)->ptr = arena_alloc((arena), size, alignof(max_align_t)); \
+            memcpy((dest)->ptr, (src).ptr, size); \
+        } \
+        (dest)->len = (src).len; \
+        (dest)->cap = (src).len; \
+        (dest)->ref = true; \
+    } while (false)
+
+const CachedParse* parse_cache_put(str source, const SyntaxTree* tree) {
+    if (cache.stats.entries == PARSE_CACHE_CAPACITY) {
+        evict(cache.lru_tail);
+    }
+
+    Arena arena = ARENA_NEW;
+    ParseCacheEntry* entry = ARENA_NEW_OBJ(&arena, ParseCacheEntry);
+    *entry = (ParseCacheEntry){.hash = hash_source(source), .refs = 1, .cached = true};
+
+    char* source_copy = ARENA_NEW_ARRAY(&arena, char, str_len(source));
+    memcpy(source_copy, str_ptr(source), str_len(source));
+    entry->base.source = str_ref_chars(source_copy, str_len(source));
+
+    SyntaxTree* copy = &entry->base.tree;
+    *copy = syntax_tree_new();
+    CLONE_BUF(&arena, &copy->words, tree->words);
+    for (uint64_t i = 0; i < copy->words.len; i++) {
+        copy->words.ptr[i] = clone_word(&arena, copy->words.ptr[i], source, source_copy);
+    }
+    CLONE_BUF(&arena, &copy->commands, tree->commands);
+    CLONE_BUF(&arena, &copy->ops, tree->ops);
+    CLONE_BUF(&arena, &copy->lists, tree->lists);
+    CLONE_BUF(&arena, &copy->redirections, tree->redirections);
+    copy->root = tree->root;
+    entry->base.program = compile_tree(copy, &arena, false);
+    entry->arena = arena;
+
+    ParseCacheEntry** bucket = &cache.buckets[entry->hash % PARSE_CACHE_BUCKETS];
+    entry->bucket_next = *bucket;
+    *bucket = entry;
+    lru_push_front(entry);
+    cache.stats.entries++;
+    return &entry->base;
+}
+
+void parse_cache_release(const CachedParse* parse) {
+    ParseCacheEntry* entry = (ParseCacheEntry*)parse;
+    entry->refs--;
+    if (entry->refs == 0 && !entry->cached) {
+        entry_free(entry);
+    }
+}
+
+void parse_cache_clear(void) {
+    while (cache.lru_head != NULL) {
+        evict(cache.lru_head);
+    }
+}
+
+ParseCacheStats parse_cache_stats(void) {
+    return cache.stats;
+}
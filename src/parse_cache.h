@@ -0,0 +1,34 @@
+#ifndef PARSE_CACHE_H_
+#define PARSE_CACHE_H_
+
+#include <stdint.h>
+#include <str/str.h>
+
+#include "ast.h"
+#include "compiler.h"
+
+// An immutable parse result shared between everyone who looks up the same
+// source text. Entries are reference counted: each successful get/put must be
+// paired with a release, and an entry evicted while still referenced is only
+// freed once its last reference is gone.
+typedef struct {
+    str source;
+    SyntaxTree tree;
+    Program program;
+} CachedParse;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t entries;
+} ParseCacheStats;
+
+const CachedParse* parse_cache_get(str source);
+// Copies tree (and the source its words point into) into a new entry,
+// replacing the least recently used one if the cache is full.
+const CachedParse* parse_cache_put(str source, const SyntaxTree* tree);
+void parse_cache_release(const CachedParse* parse);
+void parse_cache_clear(void);
+ParseCacheStats parse_cache_stats(void);
+
+#endif  // PARSE_CACHE_H_
@@ -1,194 +1,530 @@
 #include "parser.h"
 
+#include <assert.h>
+#include <inttypes.h>
 #include <println/println.h>
+#include <unistd.h>
 
-static Statements* parse_statements(Parser* parser, TokenBuf* tokens, Statements* existing);
-static bool token_is_list_op(Token token);
-static void parse_list(Parser* parser, TokenBuf* tokens, CommandList* out_list);
-static Command* parse_command(Parser* parser, TokenBuf* tokens);
+static void parse_statements(Parser* parser, AstSpanBuf* out_lists, ListBuilder* out_list);
+static void parse_more_statements(Parser* parser, AstSpanBuf* out_lists, ListBuilder* out_list);
+static bool token_is_list_op(TokenType type);
+static void parse_list(Parser* parser, ListBuilder* out_list);
+static AstCommand parse_pipeline(Parser* parser);
+static AstCommand parse_command(Parser* parser);
 
-Parser parser_new(str source) {
+Parser parser_new(str source, Arena* arena) {
     return (Parser){
-        .lexer = lexer_new(source),
+        .lexer = lexer_new(source, arena),
+        .arena = arena,
+        .window_start = 0,
+        .window_len = 0,
+        .word_spans = BUF_NEW,
+        .heredoc_words = BUF_NEW,
+        .tree = syntax_tree_new(),
         .needs_more_input = false,
     };
 }
 
-ParseResult parser_parse(Parser* parser) {
-    TokenBuf tokens = lex(&parser->lexer);
+// Returns the token n places past the next unconsumed one, lexing as needed.
+static Token peek_token(Parser* parser, uint8_t n) {
+    assert(n < PARSER_LOOKAHEAD);
+    while (parser->window_len <= n) {
+        uint8_t slot = (parser->window_start + parser->window_len) % PARSER_LOOKAHEAD;
+        parser->window[slot] = lex_next(&parser->lexer);
+        parser->window_len++;
+    }
+    return parser->window[(parser->window_start + n) % PARSER_LOOKAHEAD];
+}
 
-    TokenBuf temp_tokens = BUF_AS_REF(tokens);
-    Statements* result = parse_statements(parser, &temp_tokens, NULL);
-    if (parser->errored) {
-        BUF_FREE(tokens);
-        return (ParseResult)SUM_NOTHING;
+static TokenType current_type(Parser* parser) {
+    return peek_token(parser, 0).type;
+}
+
+static void advance(Parser* parser) {
+    peek_token(parser, 0);
+    parser->window_start = (parser->window_start + 1) % PARSER_LOOKAHEAD;
+    parser->window_len--;
+}
+
+static void skip_newlines(Parser* parser) {
+    while (current_type(parser) == TOKEN_TYPE_NEWLINE) {
+        advance(parser);
     }
-    if (parser->needs_more_input) {
-        PartialParse partial = {.tree = {.root = result}};
-        BUF_FREE(tokens);
-        return (ParseResult)SUM_JUST(SUM_RIGHT(partial));
+}
+
+static void report_unexpected(Parser* parser, const char* expected) {
+    Token token = peek_token(parser, 0);
+    str text = token_str(token, parser->lexer.source);
+    if (token.type == TOKEN_TYPE_NEWLINE) {
+        text = str_lit("\\n");
     }
-    if (temp_tokens.len > 0 && temp_tokens.ptr[0].type != TOKEN_TYPE_EOF) {
+    if (expected == NULL) {
+        fprintfln(
+            stderr,
+            "col %" PRIu32 ": syntax error (token '" str_fmt "')",
+            token.start,
+            str_arg(text)
+        );
+    } else {
         fprintfln(
             stderr,
-            "col %zu: syntax error (token '" str_fmt "')",
-            temp_tokens.ptr[0].position,
-            str_arg(temp_tokens.ptr[0].text)
+            "col %" PRIu32 ": syntax error (expected %s, not '" str_fmt "')",
+            token.start,
+            expected,
+            str_arg(text)
         );
-        statements_free(result);
-        result = NULL;
     }
-    BUF_FREE(tokens);
-    SyntaxTree tree = {.root = result};
-    return (ParseResult)SUM_JUST(SUM_LEFT(tree));
 }
 
-ParseResult parser_resume_parse(Parser* parser, PartialParse partial, str source) {
-    parser->needs_more_input = false;
-    parser->lexer = lexer_new(source);
-    TokenBuf tokens = lex(&parser->lexer);
+static AstSpan flush_list(Parser* parser, ListBuilder* list) {
+    AstSpan span = {(uint32_t)parser->tree.commands.len, (uint32_t)list->commands.len};
+    for (uint64_t i = 0; i < list->commands.len; i++) {
+        ARENA_BUF_PUSH(parser->arena, &parser->tree.commands, list->commands.ptr[i]);
+        Op op = i < list->ops.len ? list->ops.ptr[i] : OP_END;
+        ARENA_BUF_PUSH(parser->arena, &parser->tree.ops, op);
+    }
+    // the builder's storage is reused for the next list
+    list->commands.len = 0;
+    list->ops.len = 0;
+    return span;
+}
+
+static AstSpan flush_statements(Parser* parser, AstSpanBuf* lists) {
+    AstSpan span = {(uint32_t)parser->tree.lists.len, (uint32_t)lists->len};
+    for (uint64_t i = 0; i < lists->len; i++) {
+        ARENA_BUF_PUSH(parser->arena, &parser->tree.lists, lists->ptr[i]);
+    }
+    return span;
+}
+
+// Replaces the list in the builder with a BACKGROUND command that runs it.
+static void make_background(Parser* parser, ListBuilder* list) {
+    AstSpan body = flush_list(parser, list);
+    AstSpan lists = {(uint32_t)parser->tree.lists.len, 1};
+    ARENA_BUF_PUSH(parser->arena, &parser->tree.lists, body);
+    AstCommand command = {.type = COMMAND_TYPE_BACKGROUND, .negated = false, .span = lists};
+    ARENA_BUF_PUSH(parser->arena, &list->commands, command);
+}
 
-    TokenBuf temp_tokens = BUF_AS_REF(tokens);
-    Statements* result = parse_statements(parser, &temp_tokens, partial.tree.root);
+// Moves the last list into the tree, makes the lists its root and turns the
+// recorded word offsets into words.
+static void finish_tree(Parser* parser, AstSpanBuf* lists, ListBuilder* last) {
+    AstSpan list = flush_list(parser, last);
+    ARENA_BUF_PUSH(parser->arena, lists, list);
+    parser->tree.root = flush_statements(parser, lists);
+    HeredocQueue* heredocs = &parser->lexer.heredocs;
+    assert(heredocs->bodies.len == parser->heredoc_words.len);
+    for (uint64_t i = 0; i < heredocs->bodies.len; i++) {
+        Token body = heredocs->bodies.ptr[i];
+        parser->word_spans.ptr[parser->heredoc_words.ptr[i]] = (AstSpan){body.start, body.len};
+    }
+    heredocs->delimiters.len = 0;
+    heredocs->bodies.len = 0;
+    parser->heredoc_words.len = 0;
+    for (uint64_t i = 0; i < parser->word_spans.len; i++) {
+        AstSpan span = parser->word_spans.ptr[i];
+        str word = str_substr(parser->lexer.source, span.start, span.len);
+        ARENA_BUF_PUSH(parser->arena, &parser->tree.words, word);
+    }
+}
+
+static ParseResult parse_top_level(Parser* parser, PartialParse partial) {
+    if (partial.awaiting_heredoc) {
+        partial.awaiting_heredoc = false;
+        parse_more_statements(parser, &partial.lists, &partial.list);
+    } else {
+        parse_statements(parser, &partial.lists, &partial.list);
+    }
     if (parser->errored) {
-        BUF_FREE(tokens);
-        syntax_tree_free(partial.tree);
         return (ParseResult)SUM_NOTHING;
     }
+    if (!parser->needs_more_input && lexer_heredoc_pending(&parser->lexer)) {
+        // the input stopped inside a heredoc body
+        parser->needs_more_input = true;
+        partial.awaiting_heredoc = true;
+    }
     if (parser->needs_more_input) {
-        PartialParse partial = {.tree = {.root = result}};
-        BUF_FREE(tokens);
         return (ParseResult)SUM_JUST(SUM_RIGHT(partial));
     }
+    if (current_type(parser) != TOKEN_TYPE_EOF) {
+        report_unexpected(parser, NULL);
+        parser->errored = true;
+        return (ParseResult)SUM_NOTHING;
+    }
 
-    if (temp_tokens.len > 0 && temp_tokens.ptr[0].type != TOKEN_TYPE_EOF) {
+    finish_tree(parser, &partial.lists, &partial.list);
+    return (ParseResult)SUM_JUST(SUM_LEFT(parser->tree));
+}
+
+ParseResult parser_parse(Parser* parser) {
+    PartialParse partial = {
+        .lists = BUF_NEW,
+        .list = {BUF_NEW, BUF_NEW},
+        .awaiting_heredoc = false,
+    };
+    return parse_top_level(parser, partial);
+}
+
+ParseResult parser_resume_parse(Parser* parser, PartialParse partial, str source) {
+    parser->needs_more_input = false;
+    parser->lexer.source = source;
+    // the EOF token that stopped the last parse is stale now
+    parser->window_start = 0;
+    parser->window_len = 0;
+    if (partial.awaiting_heredoc) {
+        return parse_top_level(parser, partial);
+    }
+    // otherwise input is only resumed after an operator, where line breaks are
+    // allowed
+    skip_newlines(parser);
+    if (current_type(parser) == TOKEN_TYPE_EOF) {
+        parser->needs_more_input = true;
+        return (ParseResult)SUM_JUST(SUM_RIGHT(partial));
+    }
+    return parse_top_level(parser, partial);
+}
+
+// Drops the part of the source before the next token, so that token offsets
+// stay small however far into the input the parser gets.
+static void rebase_source(Parser* parser) {
+    size_t base = parser->lexer.position;
+    if (parser->window_len > 0) {
+        base = parser->window[parser->window_start].start;
+    }
+    for (uint8_t i = 0; i < parser->window_len; i++) {
+        parser->window[(parser->window_start + i) % PARSER_LOOKAHEAD].start -= (uint32_t)base;
+    }
+    parser->lexer.source = str_after(parser->lexer.source, base);
+    parser->lexer.position -= base;
+}
+
+CommandParse parser_parse_next(Parser* parser) {
+    rebase_source(parser);
+    // the caller may have reset the arena since the last command
+    parser->tree = syntax_tree_new();
+    parser->word_spans = (AstSpanBuf)BUF_NEW;
+    parser->heredoc_words = (WordIndexBuf)BUF_NEW;
+    parser->lexer.heredocs.delimiters = (TokenBuf)BUF_NEW;
+    parser->lexer.heredocs.bodies = (TokenBuf)BUF_NEW;
+
+    skip_newlines(parser);
+    if (current_type(parser) == TOKEN_TYPE_EOF) {
+        return (CommandParse)SUM_NOTHING;
+    }
+
+    AstSpanBuf lists = BUF_NEW;
+    ListBuilder list = {BUF_NEW, BUF_NEW};
+    parse_list(parser, &list);
+    while (!parser->errored &&
+           (current_type(parser) == TOKEN_TYPE_SEMI || current_type(parser) == TOKEN_TYPE_AMP)) {
+        if (current_type(parser) == TOKEN_TYPE_AMP) {
+            make_background(parser, &list);
+        }
+        advance(parser);
+        TokenType next = current_type(parser);
+        if (next == TOKEN_TYPE_NEWLINE || next == TOKEN_TYPE_EOF) {
+            break;
+        }
+        AstSpan span = flush_list(parser, &list);
+        ARENA_BUF_PUSH(parser->arena, &lists, span);
+        parse_list(parser, &list);
+    }
+    if (parser->errored) {
+        return (CommandParse)SUM_NOTHING;
+    }
+    if (parser->needs_more_input) {
+        // there is no more input to wait for
+        report_unexpected(parser, "command");
+        parser->errored = true;
+        return (CommandParse)SUM_NOTHING;
+    }
+    TokenType end = current_type(parser);
+    if (end == TOKEN_TYPE_EOF && lexer_heredoc_pending(&parser->lexer)) {
         fprintfln(
             stderr,
-            "col %zu: syntax error (token '" str_fmt "')",
-            temp_tokens.ptr[0].position,
-            str_arg(temp_tokens.ptr[0].text)
+            "col %" PRIu32 ": syntax error (unterminated heredoc)",
+            peek_token(parser, 0).start
         );
         parser->errored = true;
-        statements_free(result);
-        result = NULL;
+        return (CommandParse)SUM_NOTHING;
+    }
+    if (end != TOKEN_TYPE_NEWLINE && end != TOKEN_TYPE_EOF) {
+        report_unexpected(parser, NULL);
+        parser->errored = true;
+        return (CommandParse)SUM_NOTHING;
     }
-    BUF_FREE(tokens);
-    SyntaxTree tree = {.root = result};
-    return (ParseResult)SUM_JUST(SUM_LEFT(tree));
+    if (end == TOKEN_TYPE_NEWLINE) {
+        advance(parser);
+    }
+
+    finish_tree(parser, &lists, &list);
+    return (CommandParse)SUM_JUST(parser->tree);
 }
 
-static Statements* parse_statements(Parser* parser, TokenBuf* tokens, Statements* existing) {
-    Statements* result = existing;
-    if (result == NULL) {
-        result = statements_new();
+static bool token_is_separator(TokenType type) {
+    return type == TOKEN_TYPE_SEMI || type == TOKEN_TYPE_NEWLINE || type == TOKEN_TYPE_AMP;
+}
+
+// Parses lists separated by `;` or line breaks, optionally with a trailing
+// separator. Complete lists are moved into the tree and recorded in
+// out_lists; the last one is left in out_list, because at the top level it
+// may continue after more input arrives.
+static void parse_statements(Parser* parser, AstSpanBuf* out_lists, ListBuilder* out_list) {
+    parse_list(parser, out_list);
+    parse_more_statements(parser, out_lists, out_list);
+}
+
+// Continues parse_statements after the list in out_list.
+static void parse_more_statements(Parser* parser, AstSpanBuf* out_lists, ListBuilder* out_list) {
+    while (!parser->errored && token_is_separator(current_type(parser))) {
+        if (current_type(parser) == TOKEN_TYPE_AMP) {
+            make_background(parser, out_list);
+        }
+        advance(parser);
+        skip_newlines(parser);
+        TokenType next = current_type(parser);
+        if (next == TOKEN_TYPE_EOF || next == TOKEN_TYPE_RPAREN) {
+            break;
+        }
+        AstSpan list = flush_list(parser, out_list);
+        ARENA_BUF_PUSH(parser->arena, out_lists, list);
+        parse_list(parser, out_list);
     }
-    CommandList partial_list = existing != NULL ? BUF_LAST(existing->lists) : command_list_new();
-    parse_list(parser, tokens, &partial_list);
-    CommandList list = partial_list;  // no longer "partial" -- hopefully
-    if (existing != NULL) {
-        BUF_LAST(existing->lists) = list;
-    } else {
-        BUF_PUSH(&result->lists, list);
+}
+
+static bool token_is_list_op(TokenType type) {
+    return type == TOKEN_TYPE_AMP_AMP || type == TOKEN_TYPE_PIPE_PIPE;
+}
+
+static void parse_list(Parser* parser, ListBuilder* out_list) {
+    AstCommand command = parse_pipeline(parser);
+    ARENA_BUF_PUSH(parser->arena, &out_list->commands, command);
+    while (!parser->errored && token_is_list_op(current_type(parser))) {
+        Op op = current_type(parser) == TOKEN_TYPE_AMP_AMP ? OP_AND : OP_OR;
+        ARENA_BUF_PUSH(parser->arena, &out_list->ops, op);
+        advance(parser);
+        skip_newlines(parser);
+        if (current_type(parser) == TOKEN_TYPE_EOF) {
+            parser->needs_more_input = true;
+            break;
+        }
+        command = parse_pipeline(parser);
+        ARENA_BUF_PUSH(parser->arena, &out_list->commands, command);
     }
-    while (tokens->len > 0 && tokens->ptr[0].type == TOKEN_TYPE_SEMI) {
-        BUF_SHIFT(tokens, 1);
-        CommandList list = command_list_new();
-        parse_list(parser, tokens, &list);
-        BUF_PUSH(&result->lists, list);
+}
+
+static AstCommand parse_pipeline(Parser* parser) {
+    AstCommand first = parse_command(parser);
+    if (parser->errored || current_type(parser) != TOKEN_TYPE_PIPE) {
+        return first;
     }
 
-    if (tokens->len == 0) {
-        fprintfln(stderr, "internal error: skipped EOF");
-        abort();
+    // `!` before the first stage applies to the whole pipeline
+    AstCommand pipeline = {.type = COMMAND_TYPE_PIPELINE, .negated = first.negated};
+    first.negated = false;
+    ListBuilder stages = {BUF_NEW, BUF_NEW};
+    ARENA_BUF_PUSH(parser->arena, &stages.commands, first);
+    while (current_type(parser) == TOKEN_TYPE_PIPE) {
+        advance(parser);
+        skip_newlines(parser);
+        AstCommand stage = parse_command(parser);
+        if (parser->errored) {
+            return pipeline;
+        }
+        ARENA_BUF_PUSH(parser->arena, &stages.commands, stage);
     }
-    return result;
+    pipeline.span = flush_list(parser, &stages);
+    return pipeline;
 }
 
-static bool token_is_list_op(Token token) {
-    return token.type == TOKEN_TYPE_AMP_AMP || token.type == TOKEN_TYPE_PIPE_PIPE;
+static bool token_is_redirection(TokenType type) {
+    switch (type) {
+        case TOKEN_TYPE_IO_NUMBER:
+        case TOKEN_TYPE_LESS:
+        case TOKEN_TYPE_GREAT:
+        case TOKEN_TYPE_DGREAT:
+        case TOKEN_TYPE_LESS_AMP:
+        case TOKEN_TYPE_GREAT_AMP:
+        case TOKEN_TYPE_DLESS:
+        case TOKEN_TYPE_TLESS:
+            return true;
+        default:
+            return false;
+    }
 }
 
-static void parse_list(Parser* parser, TokenBuf* tokens, CommandList* out_list) {
-    if (tokens->len == 0) {
-        // empty list is allowed
-        return;
+static bool parse_fd(str text, int* out) {
+    // enough digits for any descriptor, few enough not to overflow
+    if (str_len(text) == 0 || str_len(text) > 9) {
+        return false;
     }
+    int fd = 0;
+    for (size_t i = 0; i < str_len(text); i++) {
+        char c = str_ptr(text)[i];
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        fd = fd * 10 + (c - '0');
+    }
+    *out = fd;
+    return true;
+}
 
-    Command* command = parse_command(parser, tokens);
-    BUF_PUSH(&out_list->commands, command);
-    while (tokens->len > 0 && token_is_list_op(tokens->ptr[0])) {
-        Op op = tokens->ptr[0].type == TOKEN_TYPE_AMP_AMP ? OP_AND : OP_OR;
-        BUF_PUSH(&out_list->ops, op);
-        BUF_SHIFT(tokens, 1);
-        if (tokens->len == 0 || tokens->ptr[0].type == TOKEN_TYPE_EOF) {
-            parser->needs_more_input = true;
+// Parses one redirection into the tree. Its path is recorded in targets and
+// `target` is left as the index there, since the command's words come first.
+static void parse_redirection(Parser* parser, AstSpanBuf* targets) {
+    str source = parser->lexer.source;
+    int fd = -1;
+    if (current_type(parser) == TOKEN_TYPE_IO_NUMBER) {
+        if (!parse_fd(token_str(peek_token(parser, 0), source), &fd)) {
+            report_unexpected(parser, "file descriptor");
+            parser->errored = true;
+            return;
+        }
+        advance(parser);
+    }
+
+    AstRedirection redirection;
+    switch (current_type(parser)) {
+        case TOKEN_TYPE_LESS:
+            redirection = (AstRedirection){REDIRECT_INPUT, STDIN_FILENO, 0};
+            break;
+        case TOKEN_TYPE_GREAT:
+            redirection = (AstRedirection){REDIRECT_OUTPUT, STDOUT_FILENO, 0};
+            break;
+        case TOKEN_TYPE_DGREAT:
+            redirection = (AstRedirection){REDIRECT_APPEND, STDOUT_FILENO, 0};
+            break;
+        case TOKEN_TYPE_LESS_AMP:
+            redirection = (AstRedirection){REDIRECT_DUP, STDIN_FILENO, 0};
+            break;
+        case TOKEN_TYPE_GREAT_AMP:
+            redirection = (AstRedirection){REDIRECT_DUP, STDOUT_FILENO, 0};
+            break;
+        case TOKEN_TYPE_DLESS:
+            redirection = (AstRedirection){REDIRECT_HEREDOC, STDIN_FILENO, 0};
             break;
+        case TOKEN_TYPE_TLESS:
+            redirection = (AstRedirection){REDIRECT_HERESTRING, STDIN_FILENO, 0};
+            break;
+        default:
+            report_unexpected(parser, "redirection");
+            parser->errored = true;
+            return;
+    }
+    if (fd != -1) {
+        redirection.fd = fd;
+    }
+    advance(parser);
+
+    if (current_type(parser) != TOKEN_TYPE_WORD) {
+        report_unexpected(parser, "redirection target");
+        parser->errored = true;
+        return;
+    }
+    Token target = peek_token(parser, 0);
+    if (redirection.type == REDIRECT_DUP) {
+        int target_fd;
+        if (!parse_fd(token_str(target, source), &target_fd)) {
+            report_unexpected(parser, "file descriptor");
+            parser->errored = true;
+            return;
         }
-        command = parse_command(parser, tokens);
-        BUF_PUSH(&out_list->commands, command);
-    }
-}
-
-static bool token_is_nonword(Token lhs, void* user) {
-    (void)user;
-    return lhs.type != TOKEN_TYPE_WORD;
-}
-
-static Command* parse_command(Parser* parser, TokenBuf* tokens) {
-    uint64_t first_nonword;
-    BUF_INDEX(*tokens, NULL, token_is_nonword, &first_nonword);
-    TokenBuf argv = BUF_BEFORE(*tokens, first_nonword);
-    BUF_SHIFT(tokens, first_nonword);
-
-    if (argv.len == 0) {
-        if (tokens->ptr[0].type == TOKEN_TYPE_LPAREN) {
-            // subshell
-            BUF_SHIFT(tokens, 1);
-            Statements* statements = parse_statements(parser, tokens, NULL);
-
-            if (tokens->len == 0 || tokens->ptr[0].type != TOKEN_TYPE_RPAREN) {
-                fprintfln(
-                    stderr,
-                    "col %zu: syntax error (expected ')' after subshell command, not '" str_fmt
-                    "')",
-                    tokens->ptr[0].position,
-                    str_arg(tokens->ptr[0].text)
-                );
-                parser->errored = true;
-                statements_free(statements);
-                return NULL;
-            }
-            BUF_SHIFT(tokens, 1);
-            return subshell_command_new(statements);
+        redirection.target = (uint32_t)target_fd;
+    } else {
+        // a heredoc's span is replaced by its body once that has been read
+        redirection.target = (uint32_t)targets->len;
+        ARENA_BUF_PUSH(parser->arena, targets, ((AstSpan){target.start, target.len}));
+    }
+    advance(parser);
+    ARENA_BUF_PUSH(parser->arena, &parser->tree.redirections, redirection);
+}
+
+static AstCommand parse_command(Parser* parser) {
+    AstCommand command = {.type = COMMAND_TYPE_SIMPLE, .negated = false, .span = {0, 0}};
+    if (current_type(parser) == TOKEN_TYPE_LPAREN) {
+        // subshell
+        advance(parser);
+        skip_newlines(parser);
+        AstSpanBuf lists = BUF_NEW;
+        ListBuilder list = {BUF_NEW, BUF_NEW};
+        parse_statements(parser, &lists, &list);
+        if (parser->errored) {
+            return command;
         }
-        fprintfln(
-            stderr,
-            "col %zu: syntax error (expected command, not '" str_fmt "')",
-            tokens->ptr[0].position,
-            str_arg(tokens->ptr[0].text)
-        );
-        parser->errored = true;
-        return NULL;
+
+        if (current_type(parser) != TOKEN_TYPE_RPAREN) {
+            report_unexpected(parser, "')' after subshell command");
+            parser->errored = true;
+            return command;
+        }
+        advance(parser);
+        AstSpan last = flush_list(parser, &list);
+        ARENA_BUF_PUSH(parser->arena, &lists, last);
+        command.type = COMMAND_TYPE_SUBSHELL;
+        command.span = flush_statements(parser, &lists);
+        return command;
     }
-    bool negated = false;
-    while (argv.len > 0 && argv.ptr[0].type == TOKEN_TYPE_WORD &&
-           str_eq(argv.ptr[0].text, str_lit("!"))) {
-        negated = !negated;
-        BUF_SHIFT(&argv, 1);
+
+    str source = parser->lexer.source;
+    while (current_type(parser) == TOKEN_TYPE_WORD &&
+           str_eq(token_str(peek_token(parser, 0), source), str_lit("!"))) {
+        command.negated = !command.negated;
+        advance(parser);
     }
-    if (argv.len == 0) {
-        fprintfln(
-            stderr,
-            "col %zu: syntax error (expected command, not '" str_fmt "')",
-            tokens->ptr[0].position,
-            str_arg(tokens->ptr[0].text)
-        );
+    command.span.start = (uint32_t)parser->word_spans.len;
+    command.redirections.start = (uint32_t)parser->tree.redirections.len;
+    AstSpanBuf targets = BUF_NEW;
+    while (true) {
+        TokenType type = current_type(parser);
+        if (type == TOKEN_TYPE_WORD) {
+            Token word = peek_token(parser, 0);
+            if (word_has_substitution(token_str(word, source))) {
+                command.expands = true;
+            }
+            ARENA_BUF_PUSH(parser->arena, &parser->word_spans, ((AstSpan){word.start, word.len}));
+            advance(parser);
+        } else if (token_is_redirection(type)) {
+            parse_redirection(parser, &targets);
+            if (parser->errored) {
+                return command;
+            }
+        } else {
+            break;
+        }
+    }
+    command.span.len = (uint32_t)parser->word_spans.len - command.span.start;
+    if (command.span.len == 0) {
+        report_unexpected(parser, "command");
         parser->errored = true;
-        return NULL;
+        return command;
+    }
+
+    // the paths go after the words, which have to stay contiguous
+    uint32_t base = (uint32_t)parser->word_spans.len;
+    for (uint64_t i = 0; i < targets.len; i++) {
+        ARENA_BUF_PUSH(parser->arena, &parser->word_spans, targets.ptr[i]);
     }
-    WordList args = BUF_NEW;
-    for (uint64_t i = 0; i < argv.len; i++) {
-        BUF_PUSH(&args, argv.ptr[i].text);
+    command.redirections.len =
+        (uint32_t)parser->tree.redirections.len - command.redirections.start;
+    for (uint32_t i = 0; i < command.redirections.len; i++) {
+        AstRedirection* redirection =
+            &parser->tree.redirections.ptr[command.redirections.start + i];
+        bool is_path = redirection->type != REDIRECT_DUP &&
+                       redirection->type != REDIRECT_HEREDOC &&
+                       redirection->type != REDIRECT_HERESTRING;
+        if (is_path) {
+            AstSpan path = targets.ptr[redirection->target];
+            if (word_has_substitution(str_substr(source, path.start, path.len))) {
+                command.expands = true;
+            }
+        }
+        if (redirection->type != REDIRECT_DUP) {
+            redirection->target += base;
+        }
+        if (redirection->type == REDIRECT_HEREDOC) {
+            ARENA_BUF_PUSH(parser->arena, &parser->heredoc_words, redirection->target);
+        }
     }
-    return simple_command_new(args, negated);
+    return command;
 }
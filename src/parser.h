@@ -6,21 +6,59 @@
 #include "ast.h"
 #include "lexer.h"
 
+// Tokens are pulled from the lexer as the parser needs them, so at most this
+// many are held at once.
+#define PARSER_LOOKAHEAD 2
+
+typedef BUF(uint32_t) WordIndexBuf;
+
 typedef struct {
     Lexer lexer;
+    // the tree is allocated here
+    Arena* arena;
+    // ring of tokens that have been lexed but not consumed
+    Token window[PARSER_LOOKAHEAD];
+    uint8_t window_start;
+    uint8_t window_len;
+    // Offsets of the words parsed so far, parallel to tree.words. The source
+    // may move when it grows, so words only become strs once parsing is done.
+    AstSpanBuf word_spans;
+    // The words that stand for heredoc bodies, in the order of the lexer's
+    // heredoc queue. Their bodies are only known once their line has ended.
+    WordIndexBuf heredoc_words;
+    SyntaxTree tree;
     bool needs_more_input;
     bool errored;
 } Parser;
 
+// A list whose commands have not been copied into the tree yet.
 typedef struct {
-    SyntaxTree tree;
+    AstCommandBuf commands;
+    OpBuf ops;
+} ListBuilder;
+
+typedef struct {
+    // top-level lists that are already complete
+    AstSpanBuf lists;
+    // the list that the end of input cut off
+    ListBuilder list;
+    // the list is complete, but heredoc bodies are still to come
+    bool awaiting_heredoc;
 } PartialParse;
 
 typedef SUM_EITHER_TYPE(SyntaxTree, PartialParse) Parse;
 typedef SUM_MAYBE_TYPE(Parse) ParseResult;
+typedef SUM_MAYBE_TYPE(SyntaxTree) CommandParse;
 
-Parser parser_new(str source);
+Parser parser_new(str source, Arena* arena);
 ParseResult parser_parse(Parser* parser);
+// Continues an incomplete parse. `source` must start with the source that was
+// parsed so far (it may have been moved); lexing resumes where it stopped.
 ParseResult parser_resume_parse(Parser* parser, PartialParse partial, str source);
+// Parses the next complete command: one line of lists separated by `;` or
+// `&`. The tree only holds that command, and the arena may be reset between
+// calls. Returns NOTHING at the end of input, or with `errored` set on a
+// syntax error.
+CommandParse parser_parse_next(Parser* parser);
 
 #endif  // PARSER_H_
@@ -0,0 +1,304 @@
+#include "path_cache.h"
+
+#include <assert.h>
+#include <buf/buf.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <println/println.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "spawn.h"
+#include "variables.h"
+
+#define DEFAULT_PATH "/bin:/usr/bin"
+// how often a hit re-checks every directory, not just its own, for a command
+// that would now shadow it
+#define FULL_CHECK_INTERVAL_NS 1000000000LL
+
+typedef struct {
+    str path;
+    // O_PATH descriptor, or -1 if the directory could not be opened.
+    int fd;
+    // identity of the directory the descriptor refers to
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+} PathDir;
+
+typedef struct {
+    str name;
+    str path;
+    uint64_t hits;
+    // index of the directory the command was found in
+    uint64_t dir;
+    bool used;
+    bool found;
+} PathCacheEntry;
+
+typedef BUF(PathDir) PathDirBuf;
+
+static struct {
+    str path_var;
+    PathDirBuf dirs;
+    // relative entries depend on the working directory, so nothing is stored
+    bool uncacheable;
+    PathCacheEntry* slots;
+    uint64_t cap;
+    uint64_t len;
+    // result handed out for names that bypass the table
+    str scratch;
+    // CLOCK_MONOTONIC_COARSE time of the last check of every directory
+    int64_t checked_ns;
+} cache;
+
+static bool timespec_eq(struct timespec a, struct timespec b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static void clear_entries(void) {
+    for (uint64_t i = 0; i < cache.cap; i++) {
+        if (cache.slots[i].used) {
+            str_free(cache.slots[i].name);
+            str_free(cache.slots[i].path);
+        }
+    }
+    free(cache.slots);
+    cache.slots = NULL;
+    cache.cap = 0;
+    cache.len = 0;
+}
+
+static void close_dirs(void) {
+    for (uint64_t i = 0; i < cache.dirs.len; i++) {
+        str_free(cache.dirs.ptr[i].path);
+        if (cache.dirs.ptr[i].fd >= 0) {
+            close(cache.dirs.ptr[i].fd);
+        }
+    }
+    BUF_FREE(cache.dirs);
+    cache.dirs = (PathDirBuf)BUF_NEW;
+}
+
+// an empty entry means the current directory
+static const char* dir_path(const PathDir* dir) {
+    return str_is_empty(dir->path) ? "." : dir->path.ptr;
+}
+
+static void open_dir(PathDir* dir) {
+    dir->fd = fd_move_high(open(dir_path(dir), O_PATH | O_DIRECTORY | O_CLOEXEC));
+    struct stat st;
+    if (dir->fd >= 0 && fstat(dir->fd, &st) == 0) {
+        dir->dev = st.st_dev;
+        dir->ino = st.st_ino;
+        dir->mtime = st.st_mtim;
+    } else {
+        dir->mtime = (struct timespec){0};
+    }
+}
+
+static void load_path(str path_var) {
+    clear_entries();
+    close_dirs();
+    str_assign(&cache.path_var, str_dup(path_var));
+    cache.uncacheable = false;
+
+    const char* field = str_ptr(path_var);
+    const char* end = str_end(path_var);
+    while (field <= end) {
+        const char* field_end = field;
+        while (field_end < end && *field_end != ':') {
+            field_end++;
+        }
+        PathDir dir = {.path = str_dup(str_ref_chars(field, (size_t)(field_end - field)))};
+        if (str_is_empty(dir.path) || dir.path.ptr[0] != '/') {
+            cache.uncacheable = true;
+        }
+        open_dir(&dir);
+        BUF_PUSH(&cache.dirs, dir);
+        field = field_end + 1;
+    }
+}
+
+static int64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Returns true if dir changed since it was opened, and takes in the change.
+static bool dir_changed(PathDir* dir) {
+    if (dir->fd < 0) {
+        // the directory may have been created since
+        open_dir(dir);
+        return dir->fd >= 0;
+    }
+    // the path is checked rather than the descriptor, which would keep
+    // referring to a directory that has been removed or replaced
+    struct stat st;
+    if (stat(dir_path(dir), &st) != 0 || st.st_dev != dir->dev || st.st_ino != dir->ino) {
+        close(dir->fd);
+        open_dir(dir);
+        return true;
+    }
+    if (!timespec_eq(st.st_mtim, dir->mtime)) {
+        dir->mtime = st.st_mtim;
+        return true;
+    }
+    return false;
+}
+
+// Returns true if any directory changed since it was opened.
+static bool dirs_changed(void) {
+    bool changed = false;
+    for (uint64_t i = 0; i < cache.dirs.len; i++) {
+        changed = dir_changed(&cache.dirs.ptr[i]) || changed;
+    }
+    cache.checked_ns = now_ns();
+    return changed;
+}
+
+// Returns true if a remembered entry may be out of date. A hit only depends
+// on its own directory, apart from a command of the same name turning up
+// earlier in $PATH; that is checked for at most once per
+// FULL_CHECK_INTERVAL_NS, so that a hit costs one stat. A miss depends on
+// every directory.
+static bool entry_stale(const PathCacheEntry* entry) {
+    if (!entry->found) {
+        return dirs_changed();
+    }
+    if (dir_changed(&cache.dirs.ptr[entry->dir])) {
+        return true;
+    }
+    return now_ns() - cache.checked_ns >= FULL_CHECK_INTERVAL_NS && dirs_changed();
+}
+
+static PathCacheEntry* find_slot(str name, uint64_t hash) {
+    uint64_t mask = cache.cap - 1;
+    for (uint64_t i = hash & mask;; i = (i + 1) & mask) {
+        PathCacheEntry* slot = &cache.slots[i];
+        if (!slot->used || str_eq(slot->name, name)) {
+            return slot;
+        }
+    }
+}
+
+static void grow(void) {
+    PathCacheEntry* old_slots = cache.slots;
+    uint64_t old_cap = cache.cap;
+    cache.cap = old_cap ? old_cap * 2 : 64;
+    cache.slots = calloc(cache.cap, sizeof(PathCacheEntry));
+    assert(cache.slots != NULL);
+    for (uint64_t i = 0; i < old_cap; i++) {
+        if (old_slots[i].used) {
+            *find_slot(old_slots[i].name, hash_name(old_slots[i].name)) = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+// Searches the directories in order. On a hit, *found_in is set to the index
+// of the directory, if it is not NULL.
+static PathLookup search_dirs(str name, uint64_t* found_in) {
+    str name_z = str_dup(name);
+    PathLookup result = {.found = false, .path = str_null};
+    for (uint64_t i = 0; i < cache.dirs.len; i++) {
+        PathDir* dir = &cache.dirs.ptr[i];
+        struct stat st;
+        if (dir->fd < 0 || fstatat(dir->fd, name_z.ptr, &st, 0) != 0 || !S_ISREG(st.st_mode) ||
+            faccessat(dir->fd, name_z.ptr, X_OK, AT_EACCESS) != 0) {
+            continue;
+        }
+        result.found = true;
+        if (str_is_empty(dir->path)) {
+            result.path = str_dup(name);
+        } else {
+            path_join(&result.path, dir->path, name);
+        }
+        if (found_in != NULL) {
+            *found_in = i;
+        }
+        break;
+    }
+    str_free(name_z);
+    return result;
+}
+
+PathLookup path_cache_lookup(str name) {
+    if (str_find_char(name, '/').found) {
+        str_assign(&cache.scratch, str_dup(name));
+        return (PathLookup){.found = true, .path = str_ref(cache.scratch)};
+    }
+
+    str path_var = variable_get(str_lit("PATH"));
+    if (path_var.ptr == NULL) {
+        path_var = str_lit(DEFAULT_PATH);
+    }
+    if (cache.path_var.ptr == NULL || !str_eq(path_var, cache.path_var)) {
+        load_path(path_var);
+        cache.checked_ns = now_ns();
+    }
+
+    if (cache.uncacheable) {
+        // reopens the relative directories if the working directory changed
+        dirs_changed();
+        PathLookup result = search_dirs(name, NULL);
+        str_assign(&cache.scratch, result.path);
+        result.path = str_ref(cache.scratch);
+        return result;
+    }
+
+    uint64_t hash = hash_name(name);
+    PathCacheEntry* slot = cache.cap ? find_slot(name, hash) : NULL;
+    if (slot != NULL && slot->used && entry_stale(slot)) {
+        clear_entries();
+        slot = NULL;
+    }
+    if (slot == NULL || !slot->used) {
+        if (cache.len * 2 >= cache.cap) {
+            grow();
+        }
+        slot = find_slot(name, hash);
+        uint64_t dir = 0;
+        PathLookup result = search_dirs(name, &dir);
+        *slot = (PathCacheEntry){
+            .name = str_dup(name),
+            .path = result.path,
+            .dir = dir,
+            .used = true,
+            .found = result.found,
+        };
+        cache.len++;
+    }
+    slot->hits++;
+    return (PathLookup){.found = slot->found, .path = str_ref(slot->path)};
+}
+
+void path_cache_clear(void) {
+    clear_entries();
+    // reopened on the next lookup
+    close_dirs();
+    str_clear(&cache.path_var);
+}
+
+void path_cache_print(void) {
+    if (cache.len == 0) {
+        printfln("hash: hash table empty");
+        return;
+    }
+    printfln("hits\tcommand");
+    for (uint64_t i = 0; i < cache.cap; i++) {
+        PathCacheEntry* slot = &cache.slots[i];
+        if (!slot->used) {
+            continue;
+        }
+        if (slot->found) {
+            printfln("%4" PRIu64 "\t" str_fmt, slot->hits, str_arg(slot->path));
+        } else {
+            printfln("%4" PRIu64 "\t" str_fmt " (not found)", slot->hits, str_arg(slot->name));
+        }
+    }
+}
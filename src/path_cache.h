@@ -0,0 +1,24 @@
+#ifndef PATH_CACHE_H_
+#define PATH_CACHE_H_
+
+#include <stdbool.h>
+#include <str/str.h>
+
+typedef struct {
+    bool found;
+    // NUL-terminated; owned by the cache and valid until the next lookup or
+    // path_cache_clear().
+    str path;
+} PathLookup;
+
+// Resolves a command name against $PATH. Results, including misses, are
+// remembered until $PATH or the mtime of one of its directories changes. A
+// hit re-checks its own directory on every lookup and the others about once a
+// second.
+// Names containing a '/' are returned unchanged.
+PathLookup path_cache_lookup(str name);
+void path_cache_clear(void);
+// Prints the remembered entries in the format used by the `hash` builtin.
+void path_cache_print(void);
+
+#endif  // PATH_CACHE_H_
@@ -0,0 +1,80 @@
+#include "script.h"
+
+#include <arena/arena.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <println/println.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "executor.h"
+#include "jobs.h"
+#include "parser.h"
+
+// Pages behind the command being run are dropped once this much has been
+// consumed, so a long script doesn't stay resident.
+#define SCRIPT_RELEASE_BYTES (1 << 20)
+
+int script_run(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintfln(stderr, "shlol: %s: %s", path, strerror(errno));
+        return 127;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        fprintfln(stderr, "shlol: %s: %s", path, strerror(errno));
+        close(fd);
+        return 126;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintfln(stderr, "shlol: %s: %s", path, strerror(errno));
+        return 126;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t released = 0;
+    // holds one command's tree and program at a time
+    Arena arena = ARENA_NEW;
+    Parser parser = parser_new(str_ref_chars(map, size), &arena);
+    int status = 0;
+    while (true) {
+        arena_reset(&arena);
+        // keep output in order with errors, as the interactive prompt does
+        fflush(stdout);
+        CommandParse parse = parser_parse_next(&parser);
+        if (!parse.present) {
+            if (parser.errored) {
+                status = 2;
+            }
+            break;
+        }
+        Program program = compile_tree(&parse.value, &arena, false);
+        status = execute_program(&program);
+        jobs_poll();
+
+        // everything before the command that just ran is done with
+        size_t consumed = (size_t)(str_ptr(parser.lexer.source) - map) / page_size * page_size;
+        if (consumed - released >= SCRIPT_RELEASE_BYTES) {
+            madvise(map + released, consumed - released, MADV_DONTNEED);
+            released = consumed;
+        }
+    }
+
+    arena_free(&arena);
+    munmap(map, size);
+    return status;
+}
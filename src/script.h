@@ -0,0 +1,10 @@
+#ifndef SCRIPT_H_
+#define SCRIPT_H_
+
+// Runs the script at `path` one command at a time and returns the status of
+// the last command, or 2 on a syntax error. The file is mapped rather than
+// read, and parsing never runs ahead of execution by more than one command,
+// so memory use does not grow with the script's size.
+int script_run(const char* path);
+
+#endif  // SCRIPT_H_
@@ -0,0 +1,270 @@
+#include "spawn.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <println/println.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "path_cache.h"
+#include "variables.h"
+
+typedef BUF(char*) RawWordList;
+
+SpawnBackend spawn_backend = SPAWN_BACKEND_POSIX_SPAWN;
+
+// NUL-terminated copies of the argument words; reset after every spawn
+static Arena argv_arena = ARENA_NEW;
+
+static const str SPAWN_BACKEND_NAMES[] = {
+#define X(x, name) str_lit_c(name),
+#include "spawn_backend.inc"
+#undef X
+};
+
+bool spawn_backend_from_name(str name, SpawnBackend* out) {
+    BUF(const str) names = BUF_ARRAY(SPAWN_BACKEND_NAMES);
+    for (uint64_t i = 0; i < names.len; i++) {
+        if (str_eq(names.ptr[i], name)) {
+            *out = (SpawnBackend)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static char* raw_word_new(str word) {
+    char* raw = ARENA_NEW_ARRAY(&argv_arena, char, str_len(word) + 1);
+    memcpy(raw, str_ptr(word), str_len(word));
+    raw[str_len(word)] = '\0';
+    return raw;
+}
+
+static RawWordList raw_argv_new(WordList argv) {
+    RawWordList raw_argv = {
+        .ptr = ARENA_NEW_ARRAY(&argv_arena, char*, argv.len + 1),
+        .len = argv.len + 1,
+        .cap = argv.len + 1,
+        .ref = true,
+    };
+    for (uint64_t i = 0; i < argv.len; i++) {
+        raw_argv.ptr[i] = raw_word_new(argv.ptr[i]);
+    }
+    raw_argv.ptr[argv.len] = NULL;
+    return raw_argv;
+}
+
+static bool dup_opens(SpawnDup dup) {
+    return dup.path.ptr != NULL;
+}
+
+noreturn void exec_process(WordList argv) {
+    PathLookup lookup = path_cache_lookup(argv.ptr[0]);
+    if (!lookup.found) {
+        printfln(str_fmt ": %s", str_arg(argv.ptr[0]), strerror(ENOENT));
+        exit(1);
+    }
+    RawWordList raw_argv = raw_argv_new(argv);
+    fflush(stdout);
+    execve(lookup.path.ptr, raw_argv.ptr, variables_envp());
+    printfln(str_fmt ": %s", str_arg(argv.ptr[0]), strerror(errno));
+    exit(1);
+}
+
+static pid_t spawn_fork(const char* path, RawWordList raw_argv, SpawnDupList dups) {
+    // the child can't allocate safely, so the paths are converted beforehand
+    char** paths = ARENA_NEW_ARRAY(&argv_arena, char*, dups.len);
+    for (uint64_t i = 0; i < dups.len; i++) {
+        paths[i] = dup_opens(dups.ptr[i]) ? raw_word_new(dups.ptr[i].path) : NULL;
+    }
+    char** envp = variables_envp();
+    pid_t pid = fork();
+    if (pid == 0) {
+        for (uint64_t i = 0; i < dups.len; i++) {
+            SpawnDup dup = dups.ptr[i];
+            if (paths[i] == NULL && dup.from == dup.to) {
+                // dup2 would leave close-on-exec set
+                fcntl(dup.to, F_SETFD, 0);
+                continue;
+            }
+            if (paths[i] == NULL) {
+                dup2(dup.from, dup.to);
+                continue;
+            }
+            int fd = open(paths[i], dup.flags, 0666);
+            if (fd == -1) {
+                printfln("%s: %s", paths[i], strerror(errno));
+                exit(1);
+            }
+            if (fd != dup.to) {
+                dup2(fd, dup.to);
+                close(fd);
+            }
+        }
+        execve(path, raw_argv.ptr, envp);
+        printfln("%s: %s", raw_argv.ptr[0], strerror(errno));
+        exit(1);
+    }
+    return pid < 0 ? -errno : pid;
+}
+
+static pid_t spawn_posix(const char* path, RawWordList raw_argv, SpawnDupList dups) {
+    pid_t pid;
+    if (dups.len == 0) {
+        int err = posix_spawn(&pid, path, NULL, NULL, raw_argv.ptr, variables_envp());
+        return err != 0 ? -err : pid;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    for (uint64_t i = 0; i < dups.len; i++) {
+        SpawnDup dup = dups.ptr[i];
+        if (dup_opens(dup)) {
+            // opened in the child, so the shell never holds the file
+            posix_spawn_file_actions_addopen(
+                &actions,
+                dup.to,
+                raw_word_new(dup.path),
+                dup.flags,
+                0666
+            );
+        } else {
+            posix_spawn_file_actions_adddup2(&actions, dup.from, dup.to);
+        }
+    }
+    int err = posix_spawn(&pid, path, &actions, NULL, raw_argv.ptr, variables_envp());
+    posix_spawn_file_actions_destroy(&actions);
+    return err != 0 ? -err : pid;
+}
+
+// posix_spawn doesn't say which step failed. If it was opening a redirection
+// path, that path is reported, as the child does itself with the fork backend.
+// Returns false if every path opens.
+static bool report_failed_open(SpawnDupList dups) {
+    for (uint64_t i = 0; i < dups.len; i++) {
+        if (!dup_opens(dups.ptr[i])) {
+            continue;
+        }
+        str path = str_dup(dups.ptr[i].path);
+        int fd = open(path.ptr, dups.ptr[i].flags | O_CLOEXEC, 0666);
+        if (fd == -1) {
+            printfln(str_fmt ": %s", str_arg(path), strerror(errno));
+            str_free(path);
+            return true;
+        }
+        close(fd);
+        str_free(path);
+    }
+    return false;
+}
+
+pid_t spawn_process(WordList argv, SpawnDupList dups) {
+    // resolve in the parent so the result stays in the cache
+    PathLookup lookup = path_cache_lookup(argv.ptr[0]);
+    if (!lookup.found) {
+        printfln(str_fmt ": %s", str_arg(argv.ptr[0]), strerror(ENOENT));
+        return -1;
+    }
+
+    RawWordList raw_argv = raw_argv_new(argv);
+    // builtin output is buffered; it has to come before the child's
+    fflush(stdout);
+    pid_t pid;
+    switch (spawn_backend) {
+        case SPAWN_BACKEND_POSIX_SPAWN:
+            pid = spawn_posix(lookup.path.ptr, raw_argv, dups);
+            break;
+        case SPAWN_BACKEND_FORK:
+            pid = spawn_fork(lookup.path.ptr, raw_argv, dups);
+            break;
+        default:
+            abort();
+    }
+    arena_reset(&argv_arena);
+    if (pid < 0) {
+        if (spawn_backend != SPAWN_BACKEND_POSIX_SPAWN || !report_failed_open(dups)) {
+            printfln(str_fmt ": %s", str_arg(argv.ptr[0]), strerror(-pid));
+        }
+        return -1;
+    }
+    return pid;
+}
+
+int process_status(const siginfo_t* info) {
+    return info->si_code == CLD_EXITED ? info->si_status : 128 + info->si_status;
+}
+
+int fd_move_high(int fd) {
+    if (fd == -1 || fd >= 10) {
+        return fd;
+    }
+    int moved = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    if (moved == -1) {
+        return fd;
+    }
+    close(fd);
+    return moved;
+}
+
+int process_pidfd(pid_t pid) {
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+}
+
+void wait_processes(const pid_t* pids, int* statuses, size_t count) {
+    // the pidfds of the processes still running, and their indices in pids
+    struct pollfd* fds = calloc(count, sizeof(struct pollfd));
+    size_t* owners = calloc(count, sizeof(size_t));
+    BUF_ASSERT(fds != NULL && owners != NULL);
+    size_t running = 0;
+    for (size_t i = 0; i < count; i++) {
+        statuses[i] = 1;
+        if (pids[i] == -1) {
+            continue;
+        }
+        int fd = process_pidfd(pids[i]);
+        if (fd == -1) {
+            // no pidfds on this kernel; fall back to waiting in order
+            siginfo_t info;
+            if (waitid(P_PID, (id_t)pids[i], &info, WEXITED) == 0) {
+                statuses[i] = process_status(&info);
+            }
+            continue;
+        }
+        fds[running] = (struct pollfd){.fd = fd, .events = POLLIN};
+        owners[running] = i;
+        running++;
+    }
+
+    while (running > 0) {
+        if (poll(fds, running, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // can't happen with valid descriptors; reap the rest blocking
+            for (size_t i = 0; i < running; i++) {
+                fds[i].revents = POLLIN;
+            }
+        }
+        for (size_t i = 0; i < running;) {
+            if (fds[i].revents == 0) {
+                i++;
+                continue;
+            }
+            siginfo_t info;
+            if (waitid(WAIT_P_PIDFD, (id_t)fds[i].fd, &info, WEXITED) == 0) {
+                statuses[owners[i]] = process_status(&info);
+            }
+            close(fds[i].fd);
+            running--;
+            fds[i] = fds[running];
+            owners[i] = owners[running];
+        }
+    }
+    free(fds);
+    free(owners);
+}
@@ -0,0 +1,64 @@
+#ifndef SPAWN_H_
+#define SPAWN_H_
+
+#include <stdbool.h>
+#include <stdnoreturn.h>
+#include <str/str.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "ast.h"
+
+typedef enum {
+#define X(x, name) SPAWN_BACKEND_##x,
+#include "spawn_backend.inc"
+#undef X
+} SpawnBackend;
+
+// Backend used by spawn_process. Defaults to posix_spawn, which avoids copying
+// the shell's page tables; fork is kept as a fallback.
+extern SpawnBackend spawn_backend;
+
+bool spawn_backend_from_name(str name, SpawnBackend* out);
+
+typedef BUF(pid_t) PidBuf;
+typedef BUF(int) FdBuf;
+
+// Makes `from` the child's descriptor `to`, as with dup2. `from` may equal
+// `to` to hand down a close-on-exec descriptor as it is. If `path` is set,
+// it is opened with `flags` as `to` instead.
+typedef struct {
+    int from;
+    int to;
+    str path;
+    int flags;
+} SpawnDup;
+
+typedef BUF(SpawnDup) SpawnDupList;
+
+// Starts argv as a child process with `dups` applied in order. Returns -1
+// (after reporting the error) if the process could not be started.
+pid_t spawn_process(WordList argv, SpawnDupList dups);
+
+// The idtype for waiting on a pidfd; older glibc doesn't declare it.
+#define WAIT_P_PIDFD ((idtype_t)3)
+
+// Opens a close-on-exec pidfd for pid. Returns -1 if the kernel has no pidfds.
+int process_pidfd(pid_t pid);
+
+// The shell status for waitid() info: the exit code, or 128 plus the signal.
+int process_status(const siginfo_t* info);
+
+// Waits for all of `pids` to exit, reaping each as soon as it does rather
+// than in order, and stores their statuses. Entries of -1 are skipped.
+void wait_processes(const pid_t* pids, int* statuses, size_t count);
+
+// Moves a descriptor the shell keeps open to 10 or above, out of the way of
+// the low ones that redirections name. Returns the new descriptor (fd itself
+// if it could not be moved); it is close-on-exec either way.
+int fd_move_high(int fd);
+
+// Replaces the current process with argv.
+noreturn void exec_process(WordList argv);
+
+#endif  // SPAWN_H_
@@ -0,0 +1,468 @@
+#include "substitution.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <println/println.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "executor.h"
+#include "jobs.h"
+#include "lexer.h"
+#include "parser.h"
+#include "spawn.h"
+
+// Output is collected on the heap up to this size. Past it, the output spills
+// into a memfd, which is mapped once it is complete.
+#define CAPTURE_SPILL_SIZE (1024 * 1024)
+#define CAPTURE_BLOCK (64 * 1024)
+
+#define IFS " \t\n"
+
+// The output of a substitution, either on the heap or mapped.
+typedef struct {
+    char* buf;
+    size_t len;
+    size_t cap;
+    char* map;
+    size_t map_len;
+} Capture;
+
+static str capture_str(const Capture* capture) {
+    if (capture->map != NULL) {
+        return str_ref_chars(capture->map, capture->map_len);
+    }
+    return str_ref_chars(capture->buf, capture->len);
+}
+
+static void capture_free(Capture* capture) {
+    free(capture->buf);
+    if (capture->map != NULL) {
+        munmap(capture->map, capture->map_len);
+    }
+}
+
+static bool capture_map(Capture* capture, int fd, size_t len) {
+    if (len == 0) {
+        return true;
+    }
+    void* map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    capture->map = map;
+    capture->map_len = len;
+    return true;
+}
+
+static void capture_reserve(Capture* capture, size_t len) {
+    if (len <= capture->cap) {
+        return;
+    }
+    size_t cap = capture->cap ? capture->cap : CAPTURE_BLOCK;
+    while (cap < len) {
+        cap *= 2;
+    }
+    capture->buf = realloc(capture->buf, cap);
+    BUF_ASSERT(capture->buf != NULL);
+    capture->cap = cap;
+}
+
+// Moves the heap part into a memfd and pulls the rest of fd after it, then
+// maps the result.
+static void capture_spill(Capture* capture, int fd) {
+    int spill = memfd_create("shlol-substitution", MFD_CLOEXEC);
+    if (spill == -1 || write(spill, capture->buf, capture->len) != (ssize_t)capture->len) {
+        fprintfln(stderr, "shlol: substitution: %s", strerror(errno));
+        if (spill != -1) {
+            close(spill);
+        }
+        return;
+    }
+    size_t len = capture->len;
+    while (true) {
+        // straight from the pipe into the memfd, without passing through here
+        ssize_t n = splice(fd, NULL, spill, NULL, CAPTURE_SPILL_SIZE, SPLICE_F_MOVE);
+        if (n == -1 && errno == EINVAL) {
+            n = read(fd, capture->buf, capture->cap);
+            if (n > 0 && write(spill, capture->buf, (size_t)n) != n) {
+                n = -1;
+            }
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    if (capture_map(capture, spill, len)) {
+        free(capture->buf);
+        capture->buf = NULL;
+        capture->len = 0;
+        capture->cap = 0;
+    }
+    close(spill);
+}
+
+// Reads fd until the end.
+static void capture_stream(Capture* capture, int fd) {
+    while (true) {
+        if (capture->len + CAPTURE_BLOCK > CAPTURE_SPILL_SIZE) {
+            capture_spill(capture, fd);
+            return;
+        }
+        capture_reserve(capture, capture->len + CAPTURE_BLOCK);
+        ssize_t n = read(fd, capture->buf + capture->len, capture->cap - capture->len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        capture->len += (size_t)n;
+    }
+}
+
+// Reads the contents of fd, mapping large regular files instead of copying
+// them.
+static void capture_file(Capture* capture, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        capture_stream(capture, fd);
+        return;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size > CAPTURE_SPILL_SIZE && capture_map(capture, fd, size)) {
+        return;
+    }
+    capture_reserve(capture, size);
+    ssize_t n = pread(fd, capture->buf, size, 0);
+    capture->len = n > 0 ? (size_t)n : 0;
+}
+
+// `$(<file)`: the file's contents, with no command run at all.
+static void capture_path(Capture* capture, str path) {
+    str raw_path = str_dup(path);
+    int fd = open(str_ptr(raw_path), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintfln(stderr, "shlol: " str_fmt ": %s", str_arg(path), strerror(errno));
+    } else {
+        capture_file(capture, fd);
+        close(fd);
+    }
+    str_free(raw_path);
+}
+
+static bool runs_in_process(const Program* program) {
+    for (uint64_t i = 0; i < program->code.len; i++) {
+        const Instruction* instruction = &program->code.ptr[i];
+        switch (instruction->opcode) {
+            case OPCODE_BUILTIN:
+                if (!builtin_is_stateless(program->words.ptr[instruction->arg.words.start])) {
+                    return false;
+                }
+                break;
+            case OPCODE_JUMP_IF_FAIL:
+            case OPCODE_JUMP_IF_OK:
+            case OPCODE_HALT:
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+// Runs the program with stdout pointing at a memfd. A pipe would fill up,
+// since nothing could read it until the program is done.
+static void capture_in_process(Capture* capture, const Program* program) {
+    int fd = memfd_create("shlol-substitution", MFD_CLOEXEC);
+    if (fd == -1) {
+        fprintfln(stderr, "shlol: substitution: %s", strerror(errno));
+        return;
+    }
+    fflush(stdout);
+    int saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    dup2(fd, STDOUT_FILENO);
+    execute_program(program);
+    fflush(stdout);
+    if (saved == -1) {
+        close(STDOUT_FILENO);
+    } else {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+    capture_file(capture, fd);
+    close(fd);
+}
+
+// Starts the tree in a child with fd as its descriptor `target`. A lone
+// external command is spawned directly; anything else gets a copy of the
+// shell, which first closes `other_end` (the shell's end of fd's pipe) and the
+// pipes of `processes`, if given: held open by the copy, a pipe whose reader
+// waits for EOF would never get it. Returns -1 (after reporting the error) on
+// failure.
+static pid_t start_tree(
+    const SyntaxTree* tree,
+    Arena* arena,
+    int fd,
+    int target,
+    int other_end,
+    const ProcessSubstitutions* processes
+) {
+    Program program = compile_tree(tree, arena, false);
+    const Instruction* first = &program.code.ptr[0];
+    if (program.code.len == 2 && first->opcode == OPCODE_EXTERNAL && !first->negated &&
+        !first->expands && first->redirections.len == 0) {
+        SpawnDup dup = {fd, target};
+        SpawnDupList dups = BUF_REF(&dup, 1);
+        WordList words = BUF_SUB(program.words, first->arg.words.start, first->arg.words.len);
+        return spawn_process(words, dups);
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (fd != target) {
+            dup2(fd, target);
+            close(fd);
+        }
+        close(other_end);
+        for (uint64_t i = 0; processes != NULL && i < processes->fds.len; i++) {
+            close(processes->fds.ptr[i]);
+        }
+        jobs_reset();
+        Program tail = compile_tree(tree, arena, true);
+        execute_program(&tail);
+    }
+    if (pid == -1) {
+        fprintfln(stderr, "shlol: fork: %s", strerror(errno));
+    }
+    return pid;
+}
+
+static void capture_child(Capture* capture, const SyntaxTree* tree, Arena* arena) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        fprintfln(stderr, "shlol: pipe: %s", strerror(errno));
+        return;
+    }
+    pid_t pid = start_tree(tree, arena, fds[1], STDOUT_FILENO, fds[0], NULL);
+    close(fds[1]);
+    if (pid != -1) {
+        capture_stream(capture, fds[0]);
+        waitpid(pid, NULL, 0);
+    }
+    close(fds[0]);
+}
+
+// Parses command, reporting the error if it is not a complete one.
+static bool parse_command(str command, Arena* arena, SyntaxTree* tree) {
+    Parser parser = parser_new(command, arena);
+    ParseResult result = parser_parse(&parser);
+    if (!result.present) {
+        return false;
+    }
+    if (!result.value.left) {
+        fprintfln(stderr, "shlol: (" str_fmt "): unexpected end of input", str_arg(command));
+        return false;
+    }
+    *tree = result.value.get.left;
+    return true;
+}
+
+static bool is_ifs(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+// Whether command is `<file`, and if so, which file.
+static bool is_file_read(str command, str* path) {
+    command = str_trim(command, str_lit(IFS));
+    if (!str_has_prefix(command, str_lit("<"))) {
+        return false;
+    }
+    *path = str_trim_left(str_after(command, 1), str_lit(IFS));
+    if (str_is_empty(*path)) {
+        return false;
+    }
+    for (size_t i = 0; i < str_len(*path); i++) {
+        if (is_ifs(str_ptr(*path)[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void capture_command(Capture* capture, str command) {
+    str path;
+    if (is_file_read(command, &path)) {
+        capture_path(capture, path);
+        return;
+    }
+
+    Arena arena = ARENA_NEW;
+    SyntaxTree tree;
+    if (parse_command(command, &arena, &tree)) {
+        Program program = compile_tree(&tree, &arena, false);
+        if (runs_in_process(&program)) {
+            capture_in_process(capture, &program);
+        } else {
+            capture_child(capture, &tree, &arena);
+        }
+    }
+    arena_free(&arena);
+}
+
+// `<(command)` or `>(command)`: starts command with its stdout or stdin on a
+// pipe, and returns the path to the other end. Returns false (after reporting
+// the error) on failure.
+static bool start_process_substitution(
+    str word,
+    Arena* arena,
+    ProcessSubstitutions* processes,
+    str* path
+) {
+    bool reads = str_ptr(word)[0] == '<';
+    str command = str_substr(word, 2, str_len(word) - 3);
+    Arena tree_arena = ARENA_NEW;
+    SyntaxTree tree;
+    int fds[2] = {-1, -1};
+    pid_t pid = -1;
+    if (!parse_command(command, &tree_arena, &tree)) {
+        // already reported
+    } else if (pipe2(fds, O_CLOEXEC) == -1) {
+        fprintfln(stderr, "shlol: pipe: %s", strerror(errno));
+    } else {
+        int child_end = reads ? fds[1] : fds[0];
+        int shell_end = reads ? fds[0] : fds[1];
+        int target = reads ? STDOUT_FILENO : STDIN_FILENO;
+        pid = start_tree(&tree, &tree_arena, child_end, target, shell_end, processes);
+        close(child_end);
+    }
+    arena_free(&tree_arena);
+
+    int shell_end = reads ? fds[0] : fds[1];
+    if (pid == -1) {
+        if (shell_end != -1) {
+            close(shell_end);
+        }
+        return false;
+    }
+    // kept clear of the low descriptors that redirections name
+    int moved = fcntl(shell_end, F_DUPFD_CLOEXEC, 10);
+    if (moved != -1) {
+        close(shell_end);
+        shell_end = moved;
+    }
+    BUF_PUSH(&processes->fds, shell_end);
+    BUF_PUSH(&processes->pids, pid);
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "/dev/fd/%d", shell_end);
+    char* copy = ARENA_NEW_ARRAY(arena, char, (size_t)len);
+    memcpy(copy, buf, (size_t)len);
+    *path = str_ref_chars(copy, (size_t)len);
+    return true;
+}
+
+typedef BUF(char) FieldBuf;
+
+static void push_field(Arena* arena, WordList* fields, const FieldBuf* field) {
+    char* copy = ARENA_NEW_ARRAY(arena, char, field->len);
+    memcpy(copy, field->ptr, field->len);
+    ARENA_BUF_PUSH(arena, fields, str_ref_chars(copy, field->len));
+}
+
+static void append(FieldBuf* field, const char* p, size_t len) {
+    if (field->len + len > field->cap) {
+        size_t cap = field->cap ? field->cap : 64;
+        while (cap < field->len + len) {
+            cap *= 2;
+        }
+        field->ptr = realloc(field->ptr, cap);
+        BUF_ASSERT(field->ptr != NULL);
+        field->cap = cap;
+    }
+    memcpy(field->ptr + field->len, p, len);
+    field->len += len;
+}
+
+WordList substitution_expand(WordList words, Arena* arena, ProcessSubstitutions* processes) {
+    WordList fields = BUF_NEW;
+    FieldBuf field = BUF_NEW;
+    for (uint64_t i = 0; i < words.len; i++) {
+        str word = words.ptr[i];
+        if (!word_has_substitution(word)) {
+            ARENA_BUF_PUSH(arena, &fields, word);
+            continue;
+        }
+
+        // a field only ends where output has a blank, and only exists if
+        // something was put in it
+        field.len = 0;
+        bool started = false;
+        const char* p = str_ptr(word);
+        const char* end = str_end(word);
+        if (*p == '<' || *p == '>') {
+            // the lexer only makes words start with these for `<(` and `>(`
+            const char* after = skip_substitution(p + 1, end);
+            str path;
+            str substitution = str_ref_chars(p, (size_t)(after - p));
+            if (start_process_substitution(substitution, arena, processes, &path)) {
+                append(&field, str_ptr(path), str_len(path));
+                started = true;
+            }
+            p = after;
+        }
+        while (p < end) {
+            if (*p != '$' || p + 1 == end || p[1] != '(') {
+                append(&field, p++, 1);
+                started = true;
+                continue;
+            }
+            // the lexer only lets through terminated substitutions
+            const char* after = skip_substitution(p + 1, end);
+            Capture capture = {0};
+            capture_command(&capture, str_ref_chars(p + 2, (size_t)(after - 1 - (p + 2))));
+            str output = capture_str(&capture);
+            const char* q = str_ptr(output);
+            const char* output_end = str_end(output);
+            // trailing line breaks are dropped rather than ending the field
+            while (output_end > q && output_end[-1] == '\n') {
+                output_end--;
+            }
+            while (q < output_end) {
+                const char* run = q;
+                while (q < output_end && !is_ifs(*q)) {
+                    q++;
+                }
+                if (q > run) {
+                    append(&field, run, (size_t)(q - run));
+                    started = true;
+                }
+                if (q < output_end) {
+                    if (started) {
+                        push_field(arena, &fields, &field);
+                        field.len = 0;
+                        started = false;
+                    }
+                    q++;
+                }
+            }
+            capture_free(&capture);
+            p = after;
+        }
+        if (started) {
+            push_field(arena, &fields, &field);
+        }
+    }
+    BUF_FREE(field);
+    return fields;
+}
@@ -0,0 +1,32 @@
+#ifndef SUBSTITUTION_H_
+#define SUBSTITUTION_H_
+
+#include <arena/arena.h>
+
+#include "ast.h"
+#include "spawn.h"
+
+// What the process substitutions of a command leave behind.
+typedef struct {
+    // The shell's ends of their pipes, which the command refers to as
+    // /dev/fd/N. They are close-on-exec, so they have to be handed down
+    // explicitly, and closed once the command has started.
+    FdBuf fds;
+    // the commands on the other ends, to be reaped along with the command
+    PidBuf pids;
+} ProcessSubstitutions;
+
+// Runs the `$(...)` command substitutions in words and splits their output
+// into fields at blanks and line breaks. Words without substitutions are
+// passed through as they are. The result is allocated from arena.
+//
+// A substitution made up only of stateless builtins runs in-process with
+// its output redirected, so it needs no fork. `$(<file)` reads the file
+// directly.
+//
+// A word starting with `<(...)` or `>(...)` starts the command reading or
+// writing a pipe, without waiting for it, and refers to the other end by
+// path. Those are recorded in `processes`.
+WordList substitution_expand(WordList words, Arena* arena, ProcessSubstitutions* processes);
+
+#endif  // SUBSTITUTION_H_
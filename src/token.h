@@ -1,22 +1,20 @@
 #ifndef TOKEN_H_
 #define TOKEN_H_
 
-#include <buf/buf.h>
-#include <stddef.h>
+#include <stdint.h>
 #include <str/str.h>
 
 #include "token_type.h"
 
+// A single token as produced by lex_next().
 typedef struct {
     TokenType type;
-    str text;
-    size_t position;
+    uint32_t start;
+    uint32_t len;
 } Token;
 
-static inline Token token_new(TokenType type, str text, size_t position) {
-    return (Token){type, text, position};
+static inline str token_str(Token token, str source) {
+    return str_substr(source, token.start, token.len);
 }
 
-typedef BUF(Token) TokenBuf;
-
 #endif  // TOKEN_H_
@@ -1,9 +1,13 @@
 #ifndef TOKEN_TYPE_H_
 #define TOKEN_TYPE_H_
 
+// token_type.inc lists plain tokens as X(name) and operators as
+// OP(name, first character).
 typedef enum {
 #define X(x) TOKEN_TYPE_##x,
+#define OP(x, c) X(x)
 #include "token_type.inc"
+#undef OP
 #undef X
 } TokenType;
 
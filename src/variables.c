@@ -0,0 +1,228 @@
+#include "variables.h"
+
+#include <assert.h>
+#include <buf/buf.h>
+#include <println/println.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+
+extern char** environ;
+
+typedef struct {
+    // NAME=VALUE, NUL-terminated, so that envp can point straight at it
+    char* pair;
+    uint32_t name_len;
+    uint32_t value_len;
+    uint64_t hash;
+    bool used;
+    bool exported;
+} Variable;
+
+typedef BUF(char*) EnvpBuf;
+
+// Open addressing with linear probing. Removal shifts the entries after the
+// hole back, so there are no tombstones.
+static struct {
+    Variable* slots;
+    uint64_t cap;
+    uint64_t len;
+    // until environ is copied in, it is the environment
+    bool imported;
+    // bumped whenever the exported variables change
+    uint64_t generation;
+    EnvpBuf envp;
+    uint64_t envp_generation;
+} variables = {.generation = 1};
+
+static Variable* find_slot(str name, uint64_t hash) {
+    uint64_t mask = variables.cap - 1;
+    for (uint64_t i = hash & mask;; i = (i + 1) & mask) {
+        Variable* slot = &variables.slots[i];
+        if (!slot->used || (slot->name_len == str_len(name) &&
+                            memcmp(slot->pair, str_ptr(name), str_len(name)) == 0)) {
+            return slot;
+        }
+    }
+}
+
+static void grow(void) {
+    Variable* old_slots = variables.slots;
+    uint64_t old_cap = variables.cap;
+    variables.cap = old_cap ? old_cap * 2 : 64;
+    variables.slots = calloc(variables.cap, sizeof(Variable));
+    assert(variables.slots != NULL);
+    uint64_t mask = variables.cap - 1;
+    for (uint64_t i = 0; i < old_cap; i++) {
+        if (!old_slots[i].used) {
+            continue;
+        }
+        uint64_t j = old_slots[i].hash & mask;
+        while (variables.slots[j].used) {
+            j = (j + 1) & mask;
+        }
+        variables.slots[j] = old_slots[i];
+    }
+    free(old_slots);
+}
+
+// The variable called name, or NULL if it is not in the table.
+static Variable* lookup(str name) {
+    if (variables.cap == 0) {
+        return NULL;
+    }
+    Variable* slot = find_slot(name, hash_name(name));
+    return slot->used ? slot : NULL;
+}
+
+// Sets name to value, adding it to the table if need be. Returns its slot.
+static Variable* store(str name, str value) {
+    if (variables.len * 2 >= variables.cap) {
+        grow();
+    }
+    uint64_t hash = hash_name(name);
+    Variable* slot = find_slot(name, hash);
+    if (slot->used) {
+        free(slot->pair);
+    } else {
+        *slot = (Variable){.name_len = (uint32_t)str_len(name), .hash = hash, .used = true};
+        variables.len++;
+    }
+    slot->value_len = (uint32_t)str_len(value);
+    slot->pair = malloc(slot->name_len + slot->value_len + 2);
+    assert(slot->pair != NULL);
+    memcpy(slot->pair, str_ptr(name), slot->name_len);
+    slot->pair[slot->name_len] = '=';
+    memcpy(slot->pair + slot->name_len + 1, str_ptr(value), slot->value_len);
+    slot->pair[slot->name_len + 1 + slot->value_len] = '\0';
+    return slot;
+}
+
+static void remove_slot(Variable* slot) {
+    free(slot->pair);
+    uint64_t mask = variables.cap - 1;
+    uint64_t hole = (uint64_t)(slot - variables.slots);
+    for (uint64_t i = (hole + 1) & mask; variables.slots[i].used; i = (i + 1) & mask) {
+        // an entry can fill the hole unless its probe starts after the hole
+        uint64_t home = variables.slots[i].hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            variables.slots[hole] = variables.slots[i];
+            hole = i;
+        }
+    }
+    variables.slots[hole].used = false;
+    variables.len--;
+}
+
+// Copies environ in, which has to happen before anything changes. Variables
+// that lookups have already brought in are the same as their environ entries.
+static void import_environment(void) {
+    if (variables.imported) {
+        return;
+    }
+    variables.imported = true;
+    for (char** entry = environ; *entry != NULL; entry++) {
+        const char* equals = strchr(*entry, '=');
+        if (equals == NULL) {
+            continue;
+        }
+        str name = str_ref_chars(*entry, (size_t)(equals - *entry));
+        if (lookup(name) == NULL) {
+            store(name, str_ref(equals + 1))->exported = true;
+        }
+    }
+}
+
+static str value_of(const Variable* slot) {
+    return str_ref_chars(slot->pair + slot->name_len + 1, slot->value_len);
+}
+
+str variable_get(str name) {
+    Variable* slot = lookup(name);
+    if (slot != NULL) {
+        return value_of(slot);
+    }
+    if (variables.imported) {
+        return str_null;
+    }
+    str name_z = str_dup(name);
+    const char* value = getenv(name_z.ptr);
+    str_free(name_z);
+    if (value == NULL) {
+        return str_null;
+    }
+    slot = store(name, str_ref(value));
+    slot->exported = true;
+    return value_of(slot);
+}
+
+void variable_set(str name, str value) {
+    import_environment();
+    Variable* slot = store(name, value);
+    if (slot->exported) {
+        variables.generation++;
+    }
+}
+
+void variable_export(str name) {
+    import_environment();
+    Variable* slot = lookup(name);
+    if (slot != NULL && !slot->exported) {
+        slot->exported = true;
+        variables.generation++;
+    }
+}
+
+void variable_unset(str name) {
+    import_environment();
+    Variable* slot = lookup(name);
+    if (slot == NULL) {
+        return;
+    }
+    if (slot->exported) {
+        variables.generation++;
+    }
+    remove_slot(slot);
+}
+
+bool variable_name_valid(str name) {
+    if (str_is_empty(name) || (name.ptr[0] >= '0' && name.ptr[0] <= '9')) {
+        return false;
+    }
+    for (size_t i = 0; i < str_len(name); i++) {
+        char c = name.ptr[i];
+        if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+              (c >= '0' && c <= '9'))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+char** variables_envp(void) {
+    if (!variables.imported) {
+        return environ;
+    }
+    if (variables.envp_generation != variables.generation) {
+        variables.envp.len = 0;
+        for (uint64_t i = 0; i < variables.cap; i++) {
+            if (variables.slots[i].used && variables.slots[i].exported) {
+                BUF_PUSH(&variables.envp, variables.slots[i].pair);
+            }
+        }
+        BUF_PUSH(&variables.envp, NULL);
+        variables.envp_generation = variables.generation;
+    }
+    return variables.envp.ptr;
+}
+
+void variables_print_exported(void) {
+    import_environment();
+    for (uint64_t i = 0; i < variables.cap; i++) {
+        if (variables.slots[i].used && variables.slots[i].exported) {
+            printfln("export %s", variables.slots[i].pair);
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef VARIABLES_H_
+#define VARIABLES_H_
+
+#include <stdbool.h>
+#include <str/str.h>
+
+// The shell's variables, including the environment it was started with.
+// The environment is only copied in once a variable is changed; until then,
+// lookups fall back to it and children inherit it as it is.
+
+// Returns the value of name, or str_null if it is unset. The value is
+// NUL-terminated and valid until name is next changed.
+str variable_get(str name);
+// Sets name to value, keeping whether it is exported.
+void variable_set(str name, str value);
+// Marks name as exported to commands. Does nothing if it is unset.
+void variable_export(str name);
+void variable_unset(str name);
+// Returns true if name can be used as a variable name.
+bool variable_name_valid(str name);
+
+// The environment for commands: the exported variables, as NAME=VALUE. The
+// array is cached and only rebuilt once an exported variable has changed, so
+// it is valid until then.
+char** variables_envp(void);
+// Prints the exported variables in the format used by the `export` builtin.
+void variables_print_exported(void);
+
+#endif  // VARIABLES_H_
@@ -0,0 +1,12 @@
+#!/bin/sh
+# Jobs started by parallel must not read its stdin, which holds the lines that
+# are still to become jobs.
+set -eu
+shlol=$1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+printf 'cat >/dev/null\necho "$1"\n' >"$dir/job.sh"
+seq 2000 >"$dir/expected"
+seq 2000 | timeout 30 "$shlol" -c "parallel -j 4 -k sh $dir/job.sh" >"$dir/actual"
+cmp "$dir/expected" "$dir/actual"
@@ -0,0 +1,21 @@
+#!/bin/sh
+# A process substitution that forks a copy of the shell, for a pipeline or a
+# list, must not keep its own pipe open, or its reader never sees EOF.
+set -eu
+shlol=$1
+
+check() {
+    actual=$(timeout 5 "$shlol" -c "$1")
+    if [ "$actual" != "$2" ]; then
+        printf '%s\nexpected: %s\nactual: %s\n' "$1" "$2" "$actual" >&2
+        exit 1
+    fi
+}
+
+check 'echo hi > >(cat | tr a-z A-Z); echo done' 'HI
+done'
+check 'echo hi > >(cat; true)' 'hi'
+check 'cat <(echo a | cat) <(echo b; echo c)' 'a
+b
+c'
+check 'diff <(echo same) <(echo same) && echo equal' 'equal'
@@ -0,0 +1,15 @@
+#!/bin/sh
+# timeout exits 125 for durations it cannot wait for, rather than computing a
+# deadline from inf, nan or an overflowing number of seconds.
+set -eu
+shlol=$1
+
+for duration in inf nan -inf 1e400 1e10 100000000d; do
+    status=0
+    timeout 5 "$shlol" -c "timeout $duration true" 2>/dev/null || status=$?
+    if [ "$status" != 125 ]; then
+        printf 'timeout %s: expected status 125, got %s\n' "$duration" "$status" >&2
+        exit 1
+    fi
+done
+timeout 5 "$shlol" -c 'timeout 0.5s true'